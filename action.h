@@ -0,0 +1,17 @@
+#ifndef _ACTION_H_
+#define _ACTION_H_
+
+/*
+ * Basics
+ * The actions alone, without ChibiOS, for the modules that only produce them.
+ */
+
+typedef char action_t;
+
+#define ACTION_STRAIGHT     'S'     // go straight forward
+#define ACTION_LEFT         'L'     // turn left
+#define ACTION_RIGHT        'R'     // turn right
+#define ACTION_BACK         'B'     // u turn
+#define ACTION_VOID         '\0'    // no action found, this should always terminate the action list
+
+#endif /* _ACTION_H_ */
@@ -1,143 +1,348 @@
 #include <stdbool.h>
 #include <stdio.h>
-#include <string.h>
 
 #include <ch.h>
 
 #include "action_queue.h"
+#include "path_journal.h"
 
 //#define	ASSERT_UNREACHABLE() printf("unreachable, %s at line %i\n", __FUNCTION__, __LINE__)
 #define	ASSERT_UNREACHABLE()
 
 /*
  * Simplify action queue
+ *
+ * Simplifications are rewrite rules: a pattern of 3 actions, a U-turn between
+ * two others, is replaced with one action. They are applied in the order of
+ * the former multi-pass version: each pass reads the list from left to right,
+ * replaces every pattern it finds starting from the left and copies the other
+ * actions, and passes follow each other until one changes nothing.
+ *
+ * The passes don't need the whole list to run, only the next 3 actions, so
+ * they run as a pipeline: an action goes into the first pass, each pass keeps
+ * at most 2 actions waiting for a third one, and hands the others (or the
+ * action replacing a pattern) over to the next pass. The list is a stack: the
+ * final output at the bottom, then the actions waiting in the last pass, and
+ * so on up to the first pass. A pass is only started when the one before
+ * makes a replacement: until then its input has no pattern, so it would only
+ * copy it. Rules are looked up in a table indexed by the 2-bit codes of 3
+ * actions, so the matching automaton is built by the compiler from the rule
+ * declarations and each lookup is O(1).
+ *
+ * An action goes through the passes until one keeps it waiting, which is one
+ * of the first few for most actions, but there is a pass per level of nested
+ * dead ends: N levels cost O(N^2), like they did with the passes run in turn.
  */
 
+#define CODE_BACK       0
+#define CODE_STRAIGHT   1
+#define CODE_LEFT       2
+#define CODE_RIGHT      3
+
+// Deeper nested dead ends are not simplified further, as if the former version
+// had stopped after that many passes.
+#define SIMPLIFY_MAX_PASSES 256
+
+static const action_t actions_by_code[4] = {
+	ACTION_BACK, ACTION_STRAIGHT, ACTION_LEFT, ACTION_RIGHT,
+};
+
 static int to_int(action_t direction) {
-	if (direction == ACTION_BACK) return 0;
-	if (direction == ACTION_STRAIGHT) return 1;
-	if (direction == ACTION_LEFT) return 2;
-	if (direction == ACTION_RIGHT) return 3;
+	if (direction == ACTION_BACK) return CODE_BACK;
+	if (direction == ACTION_STRAIGHT) return CODE_STRAIGHT;
+	if (direction == ACTION_LEFT) return CODE_LEFT;
+	if (direction == ACTION_RIGHT) return CODE_RIGHT;
 
 	ASSERT_UNREACHABLE();
 	return -1;
 }
 
-static const int table[4][4] =
-	{
-		{ -1, -1, -1, -1 }, // first is BACK
-		{ -1,  0,  3,  2 }, // first is STRAIGHT
-		{ -1,  3,  1,  0 }, // first is LEFT
-		{ -1,  2,  0,  1 }, // first is RIGHT
-	};
-static action_t collapse_three_actions(action_t a, action_t b, action_t c) {
-	int first  = to_int(a);
-	int second = to_int(b);
-	int third  = to_int(c);
-
-	if (second != 0)
-		return ACTION_VOID; // this function can't simplify this
+// a window holds the codes of 3 actions, the last one in the low bits
+#define WINDOW(a, b, c)     ((CODE_##a << 4) | (CODE_##b << 2) | CODE_##c)
+#define WINDOW_LENGTH       3
+
+// a rule tells the action that replaces the window
+#define RULE(r)                     (0x80 | CODE_##r)
+#define RULE_CODE(rule)             ((rule) & 3)
+
+// Only "x BACK y" is a rule: going into a dead end and back, the turns on both
+// sides add up. Pairs of turns (LL, RR, LR...) must not be rules: in a recorded
+// path a turn is always followed by the corridor after it, so two turns in a
+// row are a dead end collapsed next to the next turn, and rewriting them drops
+// corridors from the path.
+static const uint8_t rules[1 << (2 * WINDOW_LENGTH)] = {
+	[WINDOW(STRAIGHT, BACK, STRAIGHT)] = RULE(BACK),
+	[WINDOW(STRAIGHT, BACK, LEFT)]     = RULE(RIGHT),
+	[WINDOW(STRAIGHT, BACK, RIGHT)]    = RULE(LEFT),
+	[WINDOW(LEFT, BACK, STRAIGHT)]     = RULE(RIGHT),
+	[WINDOW(LEFT, BACK, LEFT)]         = RULE(STRAIGHT),
+	[WINDOW(LEFT, BACK, RIGHT)]        = RULE(BACK),
+	[WINDOW(RIGHT, BACK, STRAIGHT)]    = RULE(LEFT),
+	[WINDOW(RIGHT, BACK, LEFT)]        = RULE(BACK),
+	[WINDOW(RIGHT, BACK, RIGHT)]       = RULE(STRAIGHT),
+};
+
+// packed slots, see "Packed action lists"
+static unsigned get_slot(const uint8_t *data, unsigned slot);
+static void set_slot(uint8_t *data, unsigned slot, unsigned code);
+
+typedef struct {
+	uint8_t *codes;     // the stack, one code per byte
+	uint8_t *packed;    // or packed in slots, if `codes` is NULL
+	unsigned size;      // actions on the stack
+	unsigned nb_passes;
+	uint8_t waiting[SIMPLIFY_MAX_PASSES / 4]; // actions waiting in each pass, 2 bits each
+} simplifier_t;
+
+static void simplifier_init(simplifier_t *s, uint8_t *codes, uint8_t *packed) {
+	*s = (simplifier_t){ .codes = codes, .packed = packed, .nb_passes = 1 };
+}
 
-	int result = table[first][third];
+static unsigned waiting(const simplifier_t *s, unsigned pass) {
+	return get_slot(s->waiting, pass);
+}
 
-	if (result == 0) return ACTION_BACK;
-	if (result == 1) return ACTION_STRAIGHT;
-	if (result == 2) return ACTION_LEFT;
-	if (result == 3) return ACTION_RIGHT;
-	ASSERT_UNREACHABLE();
-	return ACTION_VOID;
+static void set_waiting(simplifier_t *s, unsigned pass, unsigned nb_actions) {
+	set_slot(s->waiting, pass, nb_actions);
 }
 
-static bool simplify_once(action_t *const actions) {
-	char *p = actions; // front of the simplified list
-	char *q = actions; // front of the original list
-	bool needs_another_pass = false;
+static unsigned simplifier_get(const simplifier_t *s, unsigned i) {
+	return s->codes ? s->codes[i] : get_slot(s->packed, i);
+}
 
-	char *end = actions;
-	while (*end != ACTION_VOID) end++;
-	// end now points to the ACTION_VOID at the end
+static void simplifier_set(simplifier_t *s, unsigned i, unsigned code) {
+	if (s->codes)
+		s->codes[i] = code;
+	else
+		set_slot(s->packed, i, code);
+}
 
-	while (q != end && q != end-1 && q != end-2) {
-		char result = collapse_three_actions(*q, *(q+1), *(q+2));
-		if (result) {
-			*p++ = result;
-			q+=3;
+// Pass `pass` was just handed an action, the last one waiting in it, which ends
+// at `end` on the stack. Runs the passes from there on as long as one of them
+// has 3 actions waiting.
+static void simplifier_run(simplifier_t *s, unsigned pass, unsigned end) {
+	while (waiting(s, pass) == WINDOW_LENGTH) {
+		unsigned first = end - WINDOW_LENGTH;
+		uint8_t rule = rules[(simplifier_get(s, first) << 4)
+		                     | (simplifier_get(s, first+1) << 2)
+		                     | simplifier_get(s, first+2)];
+
+		if (rule) {
+			// the pattern is replaced, the actions waiting in the passes
+			// before this one move down
+			simplifier_set(s, first, RULE_CODE(rule));
+			for (unsigned i = end; i < s->size; i++)
+				simplifier_set(s, i - (WINDOW_LENGTH-1), simplifier_get(s, i));
+			s->size -= WINDOW_LENGTH-1;
+			set_waiting(s, pass, 0);
+		} else {
+			set_waiting(s, pass, WINDOW_LENGTH-1);
+		}
 
-			if (result == ACTION_BACK)
-				needs_another_pass = true;
+		// the replacement or the first action goes to the next pass
+		end = first + 1;
+		if (++pass < s->nb_passes) {
+			set_waiting(s, pass, waiting(s, pass) + 1);
+		} else if (rule && pass < SIMPLIFY_MAX_PASSES) {
+			// A new pass, it starts with the 2 actions before, so that it
+			// sees all the patterns involving the replacement. The ones before
+			// have no pattern left, or the last pass would have replaced it.
+			set_waiting(s, pass, (first < WINDOW_LENGTH-1 ? first : WINDOW_LENGTH-1) + 1);
+			s->nb_passes++;
 		} else {
-			*p++ = *q++;
+			return; // in the output
 		}
 	}
+}
 
-	// nothing else we can collapse, let's just copy
-	while (q != end)
-		*p++ = *q++;
-	*p = ACTION_VOID;
+// The stack must have room for one more action.
+static void simplifier_push(simplifier_t *s, unsigned code) {
+	simplifier_set(s, s->size++, code);
+	set_waiting(s, 0, waiting(s, 0) + 1);
+	simplifier_run(s, 0, s->size);
+}
 
-	return needs_another_pass;
+// The end of the list: the actions waiting in each pass go to the next one, so
+// that the stack is the output of the last pass.
+static void simplifier_flush(simplifier_t *s) {
+	// the passes before `pass` are empty, its actions are on top of the stack
+	for (unsigned pass = 0; pass + 1 < s->nb_passes; pass++) {
+		while (waiting(s, pass)) {
+			set_waiting(s, pass, waiting(s, pass) - 1);
+			set_waiting(s, pass+1, waiting(s, pass+1) + 1);
+			simplifier_run(s, pass+1, s->size - waiting(s, pass));
+		}
+	}
+	s->nb_passes = 1;
+	set_waiting(s, 0, 0);
 }
 
 void simplify_action_list(action_t *const actions) {
-	while(simplify_once(actions));
+	// The front of the list is used as the stack, holding codes instead of
+	// actions. It never grows faster than we read, so this works in-place.
+	simplifier_t s;
+	simplifier_init(&s, (uint8_t *)actions, NULL);
+	for (const char *q = actions; *q != ACTION_VOID; q++)
+		simplifier_push(&s, to_int(*q));
+	simplifier_flush(&s);
+
+	for (unsigned i = 0; i < s.size; i++)
+		actions[i] = actions_by_code[s.codes[i]];
+	actions[s.size] = ACTION_VOID;
 }
 
 
 /*
  * Event Queue
+ *
+ * Lock-free multi-producer, single-consumer ring buffer. Producers reserve a
+ * slot by moving `action_queue_back` with a compare-and-swap, then publish the
+ * action in it. A slot holding ACTION_VOID is free (or reserved but not yet
+ * published), so the consumer never reads a half-written slot.
+ * Only the thread calling action_queue_pop* may move `action_queue_front`.
  */
 
 #define ACTION_QUEUE_SIZE (1<<8)
 #define ACTION_QUEUE_MASK (ACTION_QUEUE_SIZE - 1)
 
+// free-running indexes, wrapped with ACTION_QUEUE_MASK when accessing the array
 static unsigned action_queue_front;
 static unsigned action_queue_back;
 static action_t action_queue[ACTION_QUEUE_SIZE];
 
+// signaled on every push, so that the consumer doesn't have to poll
+static BSEMAPHORE_DECL(action_queue_not_empty, TRUE);
+
 bool action_queue_empty(void) {
-	chSysLock();
-	bool res = action_queue_front == action_queue_back;
-	chSysUnlock();
-	return res;
+	unsigned front = __atomic_load_n(&action_queue_front, __ATOMIC_RELAXED);
+	return __atomic_load_n(&action_queue[front & ACTION_QUEUE_MASK], __ATOMIC_ACQUIRE) == ACTION_VOID;
 }
 
 bool action_queue_full(void) {
-	chSysLock();
-	bool res = ((action_queue_back+1) & ACTION_QUEUE_MASK) == action_queue_front;
-	chSysUnlock();
-	return res;
+	unsigned back = __atomic_load_n(&action_queue_back, __ATOMIC_RELAXED);
+	return back - __atomic_load_n(&action_queue_front, __ATOMIC_ACQUIRE) >= ACTION_QUEUE_SIZE;
 }
 
 void action_queue_push(action_t action) {
 	if (!action) return;
 
-	chSysLock();
-	if (((action_queue_back+1) & ACTION_QUEUE_MASK) == action_queue_front) {
-		// the queue is already full
-		chSysUnlock();
-		return;
-	}
+	unsigned back = __atomic_load_n(&action_queue_back, __ATOMIC_RELAXED);
+	do {
+		if (back - __atomic_load_n(&action_queue_front, __ATOMIC_ACQUIRE) >= ACTION_QUEUE_SIZE)
+			return; // the queue is already full
+	} while (!__atomic_compare_exchange_n(&action_queue_back, &back, back + 1,
+	                                      true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
 
-	action_queue[action_queue_back] = action;
-	action_queue_back += 1;
-	action_queue_back &= ACTION_QUEUE_MASK;
+	__atomic_store_n(&action_queue[back & ACTION_QUEUE_MASK], action, __ATOMIC_RELEASE);
 
-	chSysUnlock();
+	// this may be called from the audio path, so it must work from any context
+	syssts_t status = chSysGetStatusAndLockX();
+	chBSemSignalI(&action_queue_not_empty);
+	chSysRestoreStatusX(status);
 }
 
 action_t action_queue_pop(void) {
-	chSysLock();
-	if (action_queue_front == action_queue_back) {
-		// we have nothing to pop
-		chSysUnlock();
-		return ACTION_VOID;
+	unsigned front = __atomic_load_n(&action_queue_front, __ATOMIC_RELAXED);
+	action_t *slot = &action_queue[front & ACTION_QUEUE_MASK];
+
+	action_t action = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+	if (action == ACTION_VOID)
+		return ACTION_VOID; // we have nothing to pop
+
+	// free the slot before handing it back to the producers
+	__atomic_store_n(slot, ACTION_VOID, __ATOMIC_RELAXED);
+	__atomic_store_n(&action_queue_front, front + 1, __ATOMIC_RELEASE);
+	return action;
+}
+
+action_t action_queue_peek(void) {
+	unsigned front = __atomic_load_n(&action_queue_front, __ATOMIC_RELAXED);
+	return __atomic_load_n(&action_queue[front & ACTION_QUEUE_MASK], __ATOMIC_ACQUIRE);
+}
+
+action_t action_queue_pop_timeout(systime_t timeout) {
+	systime_t start = chVTGetSystemTime();
+	action_t action;
+
+	while (!(action = action_queue_pop())) {
+		systime_t remaining = timeout;
+		if (timeout != TIME_INFINITE && timeout != TIME_IMMEDIATE) {
+			systime_t elapsed = chVTTimeElapsedSinceX(start);
+			if (elapsed >= timeout)
+				return ACTION_VOID;
+			remaining = timeout - elapsed;
+		}
+
+		// the semaphore may have been left signaled by an action that was
+		// already popped, in which case we simply go around once more
+		if (chBSemWaitTimeout(&action_queue_not_empty, remaining) == MSG_TIMEOUT)
+			return action_queue_pop();
+	}
+	return action;
+}
+
+
+/*
+ * Packed action lists
+ *
+ * Actions are stored as 2-bit codes (the ones from to_int), four per byte.
+ * When `rle` is set, three ACTION_STRAIGHT in a row are followed by the count of
+ * additional ACTION_STRAIGHT, one slot per digit: 0 to 2 add that many and end
+ * the run, RUN_DIGIT_MORE adds as many and another digit follows.
+ * A run of 4 to 5 actions takes 4 slots, so it never costs more than the plain
+ * actions, and then one slot per 3 actions. Only a run of exactly 3 costs one
+ * slot more: 4 actions like "SSSL" take 5 slots, which is the worst case.
+ */
+
+#define SLOTS_PER_BYTE 4
+#define RUN_START      3 // ACTION_STRAIGHT in a row before a count
+#define RUN_DIGIT_MORE 3
+
+static unsigned get_slot(const uint8_t *data, unsigned slot) {
+	return (data[slot / SLOTS_PER_BYTE] >> (2 * (slot % SLOTS_PER_BYTE))) & 3;
+}
+
+static void set_slot(uint8_t *data, unsigned slot, unsigned code) {
+	unsigned shift = 2 * (slot % SLOTS_PER_BYTE);
+	data[slot / SLOTS_PER_BYTE] &= ~(3 << shift);
+	data[slot / SLOTS_PER_BYTE] |= code << shift;
+}
+
+static void action_iterator_init(action_iterator_t *it, const uint8_t *data,
+                                 unsigned size, bool rle) {
+	it->data = data;
+	it->pos = 0;
+	it->end = size;
+	it->rle = rle;
+	it->straights = 0;
+	it->pending = 0;
+}
+
+action_t action_iterator_next(action_iterator_t *it) {
+	if (it->pending) {
+		it->pending--;
+		return ACTION_STRAIGHT;
 	}
+	if (it->pos >= it->end)
+		return ACTION_VOID;
 
-	action_t action = action_queue[action_queue_front];
-	action_queue_front += 1;
-	action_queue_front &= ACTION_QUEUE_MASK;
+	action_t action = actions_by_code[get_slot(it->data, it->pos++)];
 
-	chSysUnlock();
+	if (!it->rle)
+		return action;
+	if (action != ACTION_STRAIGHT) {
+		it->straights = 0;
+		return action;
+	}
+	if (++it->straights == RUN_START) {
+		// this is a run: the count comes next, its actions are returned later
+		unsigned digit;
+		do {
+			digit = get_slot(it->data, it->pos++);
+			it->pending += digit;
+		} while (digit == RUN_DIGIT_MORE && it->pos < it->end);
+		it->straights = 0;
+	}
 	return action;
 }
 
@@ -146,28 +351,146 @@ action_t action_queue_pop(void) {
  * Saved last path
  */
 
-static action_t saved_path[SAVED_PATH_SIZE+1];
-static unsigned saved_path_size;
+#define SAVED_PATH_SLOTS      (SAVED_PATH_BYTES * SLOTS_PER_BYTE)
+#define SIMPLIFIED_PATH_SLOTS (SIMPLIFIED_PATH_BYTES * SLOTS_PER_BYTE)
 
-void reset_saved_path(void) {
-	memset(saved_path, 0, sizeof(saved_path));
+// run-length encoded
+static uint8_t saved_path[SAVED_PATH_BYTES];
+static unsigned saved_path_size; // in slots
+static unsigned saved_path_run;  // slot of the last digit of the current run, 0 if none
+static unsigned saved_path_straights; // plain ACTION_STRAIGHT at the end, below RUN_START
+
+// used as the stack of the simplification, no run-length encoding
+static uint8_t simplified_path[SIMPLIFIED_PATH_BYTES];
+static simplifier_t simplifier;
+// get_simplified_saved_path ended the passes, the next push starts them again
+static bool simplified_path_is_flushed;
+
+// the journal is full, it is rewritten by saved_path_flush
+static bool journal_needs_rewrite;
+
+// the path was restored at boot, the next push starts a new run
+static bool saved_path_is_restored;
+
+static void clear_saved_path(void) {
 	saved_path_size = 0;
+	saved_path_run = 0;
+	saved_path_straights = 0;
+	simplifier_init(&simplifier, NULL, simplified_path);
+	simplified_path_is_flushed = false;
 }
 
-bool saved_path_push(action_t action) {
-	if (saved_path_size < SAVED_PATH_SIZE) {
-		saved_path[saved_path_size++] = action;
-		saved_path[saved_path_size] = ACTION_VOID;
+// appends to the run-length encoded path
+static bool saved_path_encode(action_t action, int code) {
+	if (action == ACTION_STRAIGHT && saved_path_run) {
+		unsigned digit = get_slot(saved_path, saved_path_run);
+		if (digit + 1 < RUN_DIGIT_MORE) {
+			set_slot(saved_path, saved_path_run, digit + 1);
+			return true;
+		}
+		// the digit becomes "3 and more", followed by a new one
+		if (saved_path_size >= SAVED_PATH_SLOTS)
+			return false;
+		set_slot(saved_path, saved_path_run, RUN_DIGIT_MORE);
+		set_slot(saved_path, saved_path_size, 0);
+		saved_path_run = saved_path_size++;
 		return true;
 	}
-	return false;
+	if (action == ACTION_STRAIGHT && saved_path_straights + 1 == RUN_START) {
+		// the last plain ACTION_STRAIGHT, followed by the count of the run
+		if (saved_path_size + 2 > SAVED_PATH_SLOTS)
+			return false;
+		set_slot(saved_path, saved_path_size, code);
+		set_slot(saved_path, saved_path_size+1, 0);
+		saved_path_run = saved_path_size + 1;
+		saved_path_size += 2;
+		saved_path_straights = 0;
+		return true;
+	}
+
+	if (saved_path_size >= SAVED_PATH_SLOTS)
+		return false;
+	set_slot(saved_path, saved_path_size++, code);
+	saved_path_run = 0;
+	saved_path_straights = action == ACTION_STRAIGHT ? saved_path_straights + 1 : 0;
+	return true;
+}
+
+// appends to the path in RAM only, and keeps its simplified form up to date
+static bool saved_path_append(action_t action) {
+	int code = to_int(action);
+	if (code < 0)
+		return false;
+
+	// the passes can't go on from a flushed path, they start again from the
+	// saved path: the same pushes as before, so they fit
+	if (simplified_path_is_flushed) {
+		action_iterator_t it;
+		action_t previous;
+		get_saved_path(&it);
+		simplifier_init(&simplifier, NULL, simplified_path);
+		while ((previous = action_iterator_next(&it)) != ACTION_VOID)
+			simplifier_push(&simplifier, to_int(previous));
+		simplified_path_is_flushed = false;
+	}
+
+	// a push never grows the simplified path by more than one
+	if (simplifier.size >= SIMPLIFIED_PATH_SLOTS)
+		return false;
+	if (!saved_path_encode(action, code))
+		return false;
+
+	simplifier_push(&simplifier, code);
+	return true;
+}
+
+void restore_saved_path(void) {
+	clear_saved_path();
+	path_journal_init();
+	path_journal_replay(&saved_path_append);
+	saved_path_is_restored = saved_path_size != 0;
 }
 
-const action_t *get_saved_path(void) {
-	return saved_path;
+void reset_saved_path(void) {
+	clear_saved_path();
+	saved_path_is_restored = false;
+	if (journal_needs_rewrite || !path_journal_reset())
+		journal_needs_rewrite = true; // the rewrite will start from the empty path
 }
 
-void get_simplified_saved_path(action_t *out) {
-	strcpy(out, saved_path);
-	simplify_action_list(out);
+bool saved_path_push(action_t action) {
+	// the restored path is only kept for a replay, a new exploration replaces it
+	if (saved_path_is_restored)
+		reset_saved_path();
+
+	if (!saved_path_append(action))
+		return false;
+
+	// once the journal is full, the actions are only in RAM until the rewrite
+	if (journal_needs_rewrite || !path_journal_append(action))
+		journal_needs_rewrite = true;
+	return true;
+}
+
+void saved_path_flush(void) {
+	if (!journal_needs_rewrite)
+		return;
+
+	// start a new journal from what we have
+	action_iterator_t it;
+	get_saved_path(&it);
+	path_journal_rewrite(&it);
+	journal_needs_rewrite = false;
+}
+
+void get_saved_path(action_iterator_t *it) {
+	action_iterator_init(it, saved_path, saved_path_size, true);
+}
+
+void get_simplified_saved_path(action_iterator_t *it) {
+	if (!simplified_path_is_flushed) {
+		simplifier_flush(&simplifier);
+		simplified_path_is_flushed = true;
+	}
+	action_iterator_init(it, simplified_path, simplifier.size, false);
 }
@@ -1,17 +1,12 @@
+#ifndef _ACTION_QUEUE_H_
+#define _ACTION_QUEUE_H_
+
 #include <stdint.h>
 #include <stdbool.h>
 
-/*
- * Basics
- */
+#include <ch.h>
 
-typedef char action_t;
-
-#define ACTION_STRAIGHT     'S'     // go straight forward
-#define ACTION_LEFT         'L'     // turn left
-#define ACTION_RIGHT        'R'     // turn right
-#define ACTION_BACK         'B'     // u turn
-#define ACTION_VOID         '\0'    // no action found, this should always terminate the action list
+#include "action.h"
 
 
 /*
@@ -21,11 +16,14 @@ typedef char action_t;
 
 // This modifies the `actions` parameter in-place.
 // This assumes the path is acyclic.
+// The result is the one of the former multi-pass version, run until it doesn't
+// change anymore (see tests/simplify_test.c).
 void simplify_action_list(action_t *const actions);
 
 
 /*
  * A circular buffer to hold the actions to come
+ * It is lock-free: any thread or interrupt may push, but only one thread may pop.
  */
 
 // Is the queue full or empty?
@@ -33,26 +31,70 @@ void simplify_action_list(action_t *const actions);
 bool action_queue_empty(void);
 bool action_queue_full(void);
 // Append an action at the end of the queue
+// This may be called from any context, including interrupt handlers.
 void action_queue_push(action_t action);
 // Returns the first action of the queue and removes it from the queue.
 // If the queue is empty, returns ACTION_VOID
 action_t action_queue_pop(void);
+// Returns the first action of the queue without removing it, ACTION_VOID if empty.
+// Only the thread that pops may call this.
+action_t action_queue_peek(void);
+// Same as action_queue_pop, but waits up to `timeout` for an action to be pushed
+// if the queue is empty. Returns ACTION_VOID if nothing came in time.
+action_t action_queue_pop_timeout(systime_t timeout);
+
+/*
+ * Packed lists of actions
+ * Actions take two bits each, and runs of ACTION_STRAIGHT may be compressed, so
+ * these lists are read through an iterator.
+ */
+
+typedef struct {
+	const uint8_t *data;
+	unsigned pos;       // next slot to read
+	unsigned end;       // number of slots
+	bool rle;           // whether runs of ACTION_STRAIGHT are compressed
+	uint8_t straights;  // ACTION_STRAIGHT in a row read before a run
+	unsigned pending;   // ACTION_STRAIGHT left to return from the current run
+} action_iterator_t;
+
+// Returns the next action of the list, or ACTION_VOID once the end is reached.
+action_t action_iterator_next(action_iterator_t *it);
 
 /*
  * A list of saved actions
- * The list is always null-terminated (ACTION_VOID-terminated) and is of size (SAVED_PATH_SIZE+1)
- * saved_path_push is well-behaved in case the list is already full.
+ * It is stored packed and run-length encoded in SAVED_PATH_BYTES. Actions take
+ * a quarter of a byte, runs of 4 or more ACTION_STRAIGHT about a third of that.
+ * Only runs of exactly 3 cost more: a path that repeats "SSS" and a turn takes
+ * 5 slots per 4 actions, so at worst it holds 3.2*SAVED_PATH_BYTES actions.
+ * saved_path_push is well-behaved in case the list is already full, or in case
+ * its simplified form doesn't fit in SIMPLIFIED_PATH_BYTES.
  */
 
-#define SAVED_PATH_SIZE (2<<10)
+#define SAVED_PATH_BYTES      (2<<10)
+#define SIMPLIFIED_PATH_BYTES (2<<10)
+// The saved path is also journaled to flash (see path_journal.h).
+// load the saved path from flash, call this once at boot.
+// It is kept until the first saved_path_push, which starts a new path.
+void restore_saved_path(void);
 // delete the saved path so that it is possible to build a new one using saved_path_push.
 // (you don't need to call that on first start)
 void reset_saved_path(void);
 // append an action to the list
 // returns true on success
 bool saved_path_push(action_t action);
-// returns a pointer to the saved path
-const action_t *get_saved_path(void);
-// returns the saved path, simplified
-// `out` must point to a buffer that must be at least (SAVED_PATH_SIZE+1) big.
-void get_simplified_saved_path(action_t *out);
+// rewrite the journal if it got full, so that the next actions are journaled again
+// This erases a flash sector, which stalls the CPU for about a second, so only
+// call it while the robot is stopped. Until then, the last actions are lost on reset.
+void saved_path_flush(void);
+// sets `it` to iterate over the saved path
+// the iterator is invalidated by the next call to saved_path_push or reset_saved_path
+void get_saved_path(action_iterator_t *it);
+// sets `it` to iterate over the saved path, simplified
+// The simplified path is kept up to date by saved_path_push, so this only
+// finishes the simplification of the last actions. The next saved_path_push
+// then simplifies the whole path again, so better call this once the path is done.
+// the iterator is invalidated by the next call to saved_path_push or reset_saved_path
+void get_simplified_saved_path(action_iterator_t *it);
+
+#endif /* _ACTION_QUEUE_H_ */
@@ -17,6 +17,84 @@
 // Module headers
 #include <arm_fft.h>
 
+/*===========================================================================*/
+/*  Module local variables                                                   */
+/*===========================================================================*/
+
+#if FFT_BACKEND == FFT_BACKEND_CFFT_F32
+//2 times FFT_MAX_SIZE because it contains complex numbers, transformed in place
+static float fft_buffer[2 * FFT_MAX_SIZE];
+#elif FFT_BACKEND == FFT_BACKEND_RFFT_F32
+static float fft_input[FFT_MAX_SIZE];
+//bins 0 and size/2 are packed in the first two floats, as they are real
+static float fft_output[FFT_MAX_SIZE];
+#elif FFT_BACKEND == FFT_BACKEND_RFFT_Q15
+//arm_rfft_q15 writes the whole spectrum, with its mirror
+static q15_t fft_output[2 * FFT_MAX_SIZE];
+//the output is downscaled by log2(size) bits
+static uint16_t fft_upscale;
+#else
+#error "unknown FFT_BACKEND"
+#endif
+
+#if FFT_CYCLE_COUNT
+static uint32_t cycles_nb_frames = 0;
+static uint32_t cycles_last = 0;
+static uint32_t cycles_worst = 0;
+static uint64_t cycles_total = 0;
+#endif
+
+_Static_assert(FFT_MAX_SIZE <= FFT_BACKEND_MAX_SIZE, "FFT_MAX_SIZE too large for FFT_BACKEND");
+
+/*===========================================================================*/
+/*  Module local functions                                                   */
+/*===========================================================================*/
+
+static const arm_cfft_instance_f32 *get_cfft_instance(uint16_t size) {
+	switch (size) {
+	case 16:	return &arm_cfft_sR_f32_len16;
+	case 32:	return &arm_cfft_sR_f32_len32;
+	case 64:	return &arm_cfft_sR_f32_len64;
+	case 128:	return &arm_cfft_sR_f32_len128;
+	case 256:	return &arm_cfft_sR_f32_len256;
+	case 512:	return &arm_cfft_sR_f32_len512;
+	case 1024:	return &arm_cfft_sR_f32_len1024;
+	case 2048:	return &arm_cfft_sR_f32_len2048;
+	case 4096:	return &arm_cfft_sR_f32_len4096;
+	default:	return NULL;
+	}
+}
+
+static bool backend_compute(uint16_t size, int16_t *samples){
+	if(!FFT_SIZE_IS_SUPPORTED(size))
+		return false;
+
+#if FFT_BACKEND == FFT_BACKEND_CFFT_F32
+	for(uint16_t i = 0 ; i < size ; i++){
+		fft_buffer[2*i] = (float)samples[i];
+		fft_buffer[2*i+1] = 0;
+	}
+	arm_cfft_f32(get_cfft_instance(size), fft_buffer, 0, 1);
+
+#elif FFT_BACKEND == FFT_BACKEND_RFFT_F32
+	static arm_rfft_fast_instance_f32 instance;
+	for(uint16_t i = 0 ; i < size ; i++)
+		fft_input[i] = (float)samples[i];
+	if(arm_rfft_fast_init_f32(&instance, size) != ARM_MATH_SUCCESS)
+		return false;
+	arm_rfft_fast_f32(&instance, fft_input, fft_output, 0);
+
+#elif FFT_BACKEND == FFT_BACKEND_RFFT_Q15
+	static arm_rfft_instance_q15 instance;
+	if(arm_rfft_init_q15(&instance, size, 0, 1) != ARM_MATH_SUCCESS)
+		return false;
+	arm_rfft_q15(&instance, samples, fft_output);
+	fft_upscale = size;
+#endif
+
+	return true;
+}
+
 /*===========================================================================*/
 /*  Module exported functions                                                */
 /*===========================================================================*/
@@ -30,8 +108,68 @@
  */
 void doFFT_optimized(uint16_t size, float* complex_buffer_input,
 									float* complex_buffer_output){
-	if(size == 1024){
-		arm_cfft_f32(&arm_cfft_sR_f32_len1024, complex_buffer_input, 0, 1);
+	const arm_cfft_instance_f32 *instance = get_cfft_instance(size);
+	if(instance){
+		arm_cfft_f32(instance, complex_buffer_input, 0, 1);
 		arm_cmplx_mag_f32(complex_buffer_input, complex_buffer_output, size);
 	}
-}
\ No newline at end of file
+}
+
+bool fft_compute(uint16_t size, int16_t *samples){
+#if FFT_CYCLE_COUNT
+	rtcnt_t start = chSysGetRealtimeCounterX();
+	bool computed = backend_compute(size, samples);
+	rtcnt_t cycles = chSysGetRealtimeCounterX() - start;
+
+	if(computed){
+		chSysLock();
+		cycles_nb_frames++;
+		cycles_last = cycles;
+		if(cycles > cycles_worst)
+			cycles_worst = cycles;
+		cycles_total += cycles;
+		chSysUnlock();
+	}
+	return computed;
+#else
+	return backend_compute(size, samples);
+#endif
+}
+
+void fft_band_magnitude(uint16_t first_bin, uint16_t nb_bins, float *magnitude){
+#if FFT_BACKEND == FFT_BACKEND_CFFT_F32
+	arm_cmplx_mag_f32(&fft_buffer[2*first_bin], magnitude, nb_bins);
+
+#elif FFT_BACKEND == FFT_BACKEND_RFFT_F32
+	for(uint16_t i = 0 ; i < nb_bins ; i++){
+		uint16_t bin = first_bin + i;
+		if(bin == 0){
+			magnitude[i] = fabsf(fft_output[0]);
+			continue;
+		}
+		float re = fft_output[2*bin];
+		float im = fft_output[2*bin+1];
+		arm_sqrt_f32(re*re + im*im, &magnitude[i]);
+	}
+
+#elif FFT_BACKEND == FFT_BACKEND_RFFT_Q15
+	for(uint16_t i = 0 ; i < nb_bins ; i++){
+		uint16_t bin = first_bin + i;
+		float re = fft_output[2*bin];
+		float im = fft_output[2*bin+1];
+		arm_sqrt_f32(re*re + im*im, &magnitude[i]);
+		magnitude[i] *= fft_upscale;
+	}
+#endif
+}
+
+#if FFT_CYCLE_COUNT
+void fft_get_cycles(fft_cycles_t *cycles){
+	chSysLock();
+	cycles->nb_frames = cycles_nb_frames;
+	cycles->last = cycles_last;
+	cycles->worst = cycles_worst;
+	cycles->average = cycles_nb_frames ? cycles_total / cycles_nb_frames : 0;
+	chSysUnlock();
+}
+#endif
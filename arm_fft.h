@@ -1,11 +1,84 @@
 /**
  * @file    arm_fft.h
  * @brief   FFT optimized for ARM based e-puck 2, taken from TP 5
+ *
+ * The spectrum of the microphone is computed by one of these backends,
+ * selected at build time with FFT_BACKEND. Buffers are sized for FFT_MAX_SIZE.
+ *
+ * Backend          RAM used for FFT_MAX_SIZE = 1024
+ * CFFT_F32         8 KiB, complex FFT with the imaginary part set to 0
+ * RFFT_F32         8 KiB, real FFT, half the work of the complex one
+ * RFFT_Q15         4 KiB, fixed-point real FFT fed with the samples directly
+ *
+ * Built with FFT_CYCLE_COUNT, fft_compute counts its cycles on the robot,
+ * see fft_get_cycles. The host bench of tests/ only ranks the backends.
  */
 
 #ifndef _ARM_FFT_H_
 #define _ARM_FFT_H_
 
+#include <stdbool.h>
+#include <stdint.h>
+
+/*========================================================================*/
+/*  Module constants                                                      */
+/*========================================================================*/
+
+#define FFT_BACKEND_CFFT_F32    0
+#define FFT_BACKEND_RFFT_F32    1
+#define FFT_BACKEND_RFFT_Q15    2
+
+#ifndef FFT_BACKEND
+#define FFT_BACKEND             FFT_BACKEND_RFFT_F32
+#endif
+
+#if FFT_BACKEND == FFT_BACKEND_CFFT_F32
+#define FFT_BACKEND_NAME        "CFFT_F32"
+#elif FFT_BACKEND == FFT_BACKEND_RFFT_F32
+#define FFT_BACKEND_NAME        "RFFT_F32"
+#else
+#define FFT_BACKEND_NAME        "RFFT_Q15"
+#endif
+
+#ifndef FFT_CYCLE_COUNT
+#define FFT_CYCLE_COUNT         0
+#endif
+
+#ifndef FFT_MAX_SIZE
+#define FFT_MAX_SIZE            1024
+#endif
+
+//Sizes the CMSIS 4.x functions of the backend accept, all powers of two
+#if FFT_BACKEND == FFT_BACKEND_RFFT_Q15
+#define FFT_BACKEND_MAX_SIZE    8192    // arm_rfft_init_q15
+#else
+#define FFT_BACKEND_MAX_SIZE    4096    // arm_cfft_f32, arm_rfft_fast_init_f32
+#endif
+#define FFT_BACKEND_MIN_SIZE    32
+
+//Whether fft_compute takes this size, usable in static assertions
+#define FFT_SIZE_IS_SUPPORTED(size) \
+	((size) >= FFT_BACKEND_MIN_SIZE && (size) <= FFT_MAX_SIZE \
+	 && (size) <= FFT_BACKEND_MAX_SIZE && ((size) & ((size) - 1)) == 0)
+
+//Static buffers of the backend
+#if FFT_BACKEND == FFT_BACKEND_RFFT_Q15
+#define FFT_BUFFER_BYTES        (2 * FFT_MAX_SIZE * sizeof(int16_t))
+#else
+#define FFT_BUFFER_BYTES        (2 * FFT_MAX_SIZE * sizeof(float))
+#endif
+
+/*========================================================================*/
+/*  Module data structures and types                                      */
+/*========================================================================*/
+
+typedef struct {
+	uint32_t nb_frames;
+	uint32_t last;              // [cycles]
+	uint32_t worst;             // [cycles]
+	uint32_t average;           // [cycles]
+} fft_cycles_t;
+
 /*========================================================================*/
 /*  External declarations                                                 */
 /*========================================================================*/
@@ -13,11 +86,41 @@
 /**
  * @brief 
  * 
- * @param size 
+ * @param size                      Any size supported by arm_cfft_f32, from 16 to 4096
  * @param complex_buffer_input 		// modified !
  * @param complex_buffer_output 
  */
 void doFFT_optimized(uint16_t size, float* complex_buffer_input,
 									float* complex_buffer_output);
 
-#endif /* _ARM_FFT_H_ */
\ No newline at end of file
+/**
+ * @brief                   Computes the spectrum of real samples with FFT_BACKEND.
+ *
+ * @param size              See FFT_SIZE_IS_SUPPORTED
+ * @param samples           // modified by the RFFT_Q15 backend !
+ * @return                  false if the size isn't supported, the spectrum
+ *                          is then left as it was
+ */
+bool fft_compute(uint16_t size, int16_t *samples);
+
+/**
+ * @brief                   Magnitude of some bins of the last computed spectrum.
+ * @note                    Whatever the backend, the scale is the one of a float
+ *                          FFT of the int16_t samples.
+ *
+ * @param first_bin         First bin wanted
+ * @param nb_bins           Number of bins wanted, they must be under size/2
+ * @param magnitude         Output, nb_bins long
+ */
+void fft_band_magnitude(uint16_t first_bin, uint16_t nb_bins, float *magnitude);
+
+#if FFT_CYCLE_COUNT
+/**
+ * @brief                   Cycles taken by fft_compute since boot, counted
+ *                          with the cycle counter of the core (DWT->CYCCNT,
+ *                          which chSysGetRealtimeCounterX reads).
+ */
+void fft_get_cycles(fft_cycles_t *cycles);
+#endif
+
+#endif /* _ARM_FFT_H_ */
@@ -5,6 +5,7 @@
 
 // C standard headers
 #include <math.h>
+#include <stdlib.h>
 
 // ChibiOS headers
 #include "hal.h"
@@ -20,6 +21,7 @@
 #include "distance.h"
 #include "ir_sensors.h"
 #include "move_command.h"
+#include "pid.h"
 
 /*===========================================================================*/
 /* Module constants.                                                         */
@@ -33,17 +35,20 @@
 #define LINK_UPPER_CLAMP            25
 #define LINK_LOWER_CLAMP            -25
 #define LINK_KP                     0.3f
-#define LINK_KI                     0.0f
-#define LINK_KD                     120.0f
-#define MAX_SUM_ERROR 			    100
+#define LINK_KI                     0.0f    // [1/s]
+#define LINK_KD                     6.0f    // [s], was 120 per 50ms tick
 //Walls constants.
 #define WALL_EDGE_THLD              100 // IR3 & IR6
 #define END_OF_CORRIDOR_FORWARD_DISTANCE 80 // mm
 #define FRONT_WALL_THLD             1500 // IR1 & IR8
 #define FRONT_SIDE_WALL_THLD        1000 // IR2 & IR7
+#define SIDE_OPENING_THLD           100 // IR2 & IR7, the side wall ends ahead
+//Speed constants, the correction must stay within MAX_SPEED
+#define CORRIDOR_CRUISE_SPEED       (800 - LINK_UPPER_CLAMP)
+#define APPROACH_SPEED              400 // once an opening is seen ahead
 //Thread constants.
-#define CORRIDOR_NAV_THD_PERIOD         100
-#define CORRIDOR_NAV_THD_ACTIVE_PERIOD  50
+#define IR_SAMPLE_TIMEOUT               50  // [ms] then checks again anyway
+#define CORRIDOR_EVT_START              EVENT_MASK(0)
 
 #define CLAMP(a, min, max) (((a)<(min)) ? (min) : (((a)>(max))? (max) : (a)))
 
@@ -51,10 +56,16 @@
 /* Module local variables.                                                   */
 /*===========================================================================*/
 
+static thread_t *corridor_nav_thd_ptr = NULL;
 static bool corridor_nav_thd_paused = true;
 static bool front_wall_detected = false;
 static bool corridor_end_detected = false;
 
+//Keeps the robot between the side walls
+static pid_controller_t corridor_pid;
+//Common speed of both wheels, before the correction
+static int16_t corridor_speed = 0;
+
 /*===========================================================================*/
 /* Semaphores.                                                               */
 /*===========================================================================*/
@@ -65,45 +76,60 @@ static BSEMAPHORE_DECL(corridor_end_detected_semaphore, TRUE);
 /* Module local functions.                                                   */
 /*===========================================================================*/
 
-bool check_corridor_end(void) {
-	if(get_ir_delta(IR3) < WALL_EDGE_THLD)
+/**
+ * @param ir        The sample to decide on
+ * @param horizon   [ms] until the next check
+ */
+bool check_corridor_end(const ir_snapshot_t *ir, uint16_t horizon) {
+	if(ir->filtered[IR3] < WALL_EDGE_THLD)
 		return true;
-	if(get_ir_delta(IR6) < WALL_EDGE_THLD)
+	if(ir->filtered[IR6] < WALL_EDGE_THLD)
 		return true;
-	if(dist_get_distance() <= END_OF_CORRIDOR_FORWARD_DISTANCE)
+	//where the wall will be at the next check, not where it was
+	if(dist_get_predicted_distance(horizon) <= END_OF_CORRIDOR_FORWARD_DISTANCE)
 		return true;
 	return false;
 }
 
-int16_t pid_regulator(float current, float target)
-{
-	static float sum_error = 0.0f;
-	static float last_error = 0.0f;
-
-	float error = current - target;
-	sum_error += error;
-	sum_error = CLAMP(sum_error, -MAX_SUM_ERROR, MAX_SUM_ERROR);
-
-	float derivative = error - last_error;
+/**
+ * @brief           Fastest speed from which the robot still stops where the
+ *                  corridor ends, ramped up from the previous one.
+ * @param ir        The sample to decide on
+ * @param dt        [s] since the previous sample
+ */
+int16_t corridor_speed_control(const ir_snapshot_t *ir, float dt) {
+	int16_t target = CORRIDOR_CRUISE_SPEED;
 
-	last_error = error;
+	//the diagonal sensors see a side opening before IR3 & IR6 do
+	if(ir->filtered[IR2] < SIDE_OPENING_THLD || ir->filtered[IR7] < SIDE_OPENING_THLD)
+		target = APPROACH_SPEED;
 
-	float control = LINK_KP * error + LINK_KI * sum_error + LINK_KD * derivative;
+	//room left at the next sample before the front wall ends the corridor, in cm
+	float room = ((float)dist_get_predicted_distance(dt * 1000)
+	              - END_OF_CORRIDOR_FORWARD_DISTANCE) / 10.0f;
+	int16_t braking = get_braking_speed(room);
+	if(braking < target)
+		target = braking;
 
-	return (int16_t) CLAMP(control, LINK_LOWER_CLAMP, LINK_UPPER_CLAMP);
+	return get_ramped_speed(corridor_speed, target, dt);
 }
 
-void corridor_pid_control(void) {
+/**
+ * @param ir        The sample to regulate on
+ * @param dt        [s] since the previous sample
+ */
+void corridor_pid_control(const ir_snapshot_t *ir, float dt) {
     int32_t delta_speed = 0;
-    int32_t left_right_ir_delta = 0;
+    //positive when the robot is closer to the left wall
+    int32_t right_left_ir_delta = ir->filtered[IR3] - ir->filtered[IR6];
 
-    left_right_ir_delta = get_ir_delta(IR6) - get_ir_delta(IR3);
-    delta_speed = pid_regulator(left_right_ir_delta, 0.0);
+    delta_speed = pid_update(&corridor_pid, 0.0f, right_left_ir_delta, dt);
 
-    if(fabs(delta_speed) < CORRECTION_THLD) delta_speed = 0;
+    if(abs(delta_speed) < CORRECTION_THLD) delta_speed = 0;
 
-    set_lr_speed(DEFAULT_SPEED + delta_speed,
-                 DEFAULT_SPEED - delta_speed);
+    corridor_speed = corridor_speed_control(ir, dt);
+    set_lr_speed(corridor_speed + delta_speed,
+                 corridor_speed - delta_speed);
 }
 
 /*===========================================================================*/
@@ -117,19 +143,27 @@ static THD_FUNCTION(corridor_nav_thd, arg)
 	(void)arg;
 
 	while (!chThdShouldTerminateX()) {
-		systime_t time = chVTGetSystemTime();
+		//sleeps until navigate_corridor
+		chEvtWaitAny(CORRIDOR_EVT_START);
 
 		if (!corridor_nav_thd_paused) {
-			while (!corridor_end_detected) {
-				corridor_end_detected = check_corridor_end();
-				corridor_pid_control();
-				chThdSleepUntilWindowed(time, time + MS2ST(CORRIDOR_NAV_THD_ACTIVE_PERIOD));
+			ir_snapshot_t ir;
+			get_ir_snapshot(&ir);
+
+			//runs once per new IR sample
+			while (!corridor_end_detected && !corridor_nav_thd_paused) {
+				systime_t last_timestamp = ir.timestamp;
+				if (!wait_ir_snapshot(&ir, ir.seq, MS2ST(IR_SAMPLE_TIMEOUT)))
+					continue;
+
+				systime_t period = ir.timestamp - last_timestamp;
+				corridor_end_detected = check_corridor_end(&ir, ST2MS(period));
+				corridor_pid_control(&ir, ST2MS(period) / 1000.0f);
 			}
+			//the robot goes on at its last speed, the next command takes over from it
 			corridor_nav_thd_paused = true;
 			chBSemSignal(&corridor_end_detected_semaphore);
 		}
-
-		chThdSleepUntilWindowed(time, time + MS2ST(CORRIDOR_NAV_THD_PERIOD));
 	}
 	chThdExit(0);
 }
@@ -139,8 +173,10 @@ static THD_FUNCTION(corridor_nav_thd, arg)
 /*===========================================================================*/
 
 void create_corridor_navigation_thd(void) {
-	chThdCreateStatic(wa_corridor_nav_thd, sizeof(wa_corridor_nav_thd),
-	                  NORMALPRIO, corridor_nav_thd, NULL);
+	pid_init(&corridor_pid, LINK_KP, LINK_KI, LINK_KD,
+	         LINK_LOWER_CLAMP, LINK_UPPER_CLAMP);
+	corridor_nav_thd_ptr = chThdCreateStatic(wa_corridor_nav_thd,
+	                  sizeof(wa_corridor_nav_thd), NORMALPRIO, corridor_nav_thd, NULL);
 }
 
 void disable_corridor_navigation_thd(void) {
@@ -152,9 +188,14 @@ bool corridor_navigation_thd_status(void) {
 }
 
 void navigate_corridor(void) {
+	//nothing from the previous corridor
+	pid_reset(&corridor_pid);
+	//the ramp goes on from the speed the robot enters at
+	corridor_speed = get_current_speed();
 	corridor_nav_thd_paused = false;
 	front_wall_detected = false;
 	corridor_end_detected = false;
+	chEvtSignal(corridor_nav_thd_ptr, CORRIDOR_EVT_START);
 }
 
 binary_semaphore_t *get_corridor_end_detected_semaphore_ptr(void) {
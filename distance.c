@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <math.h>
 
 #include "ch.h"
 #include "hal.h"
@@ -11,6 +12,32 @@
 
 #include "distance.h"
 
+// timing budgets VL53L0X_configAccuracy sets for the profiles, a measurement
+// is ready that long after the previous one in continuous ranging
+#define DIST_HIGH_SPEED_BUDGET  20      // [ms]
+#define DIST_DEFAULT_BUDGET     30      // [ms]
+// after a measurement, the thread sleeps until DIST_POLL_PERIOD before the
+// budget runs out, then asks the sensor every DIST_POLL_PERIOD whether the
+// next one is ready
+#define DIST_POLL_PERIOD        2       // [ms]
+
+// alpha-beta filter gains, for measurements every ~20ms
+#define DIST_ALPHA              0.5f
+#define DIST_BETA               0.1f
+
+// the closing speed is only trusted for so long: a measurement older than
+// DIST_STALE_AGE is returned as is, and a prediction never extrapolates
+// further than DIST_MAX_EXTRAPOLATION past the measurement
+#define DIST_STALE_AGE          100     // [ms] a few missed measurements
+#define DIST_MAX_EXTRAPOLATION  200     // [ms]
+
+// profile switching: fast ranging near a wall or when moving, the more
+// accurate default profile otherwise
+#define PROFILE_NEAR_DISTANCE   200     // [mm] high speed below
+#define PROFILE_FAR_DISTANCE    300     // [mm] default above, when still
+#define PROFILE_MOVING_SPEED    50.0f   // [mm/s] high speed above
+#define PROFILE_MIN_MEASURES    10      // between two switches
+
 static uint16_t distance = 0;
 
 static const uint16_t hysteresis_close_threshold = 90;
@@ -21,6 +48,70 @@ static bool obstacle_is_close = true;
 
 static VL53L0X_Dev_t device;
 
+// last measurement, read and written with the kernel locked
+static dist_measure_t measure = {0};
+
+static VL53L0X_AccuracyMode current_profile = VL53L0X_HIGH_SPEED;
+
+static uint16_t profile_budget(VL53L0X_AccuracyMode profile) {
+    return profile == VL53L0X_HIGH_SPEED ? DIST_HIGH_SPEED_BUDGET : DIST_DEFAULT_BUDGET;
+}
+
+static void start_ranging(VL53L0X_AccuracyMode profile) {
+    VL53L0X_configAccuracy(&device, profile);
+    VL53L0X_startMeasure(&device, VL53L0X_DEVICEMODE_CONTINUOUS_RANGING);
+    current_profile = profile;
+}
+
+// chooses the ranging profile, with hysteresis on the distance
+static void update_profile(const dist_measure_t *m) {
+    static uint16_t measures_since_switch = 0;
+
+    if (++measures_since_switch < PROFILE_MIN_MEASURES)
+        return;
+
+    bool moving = fabsf(m->closing_speed) > PROFILE_MOVING_SPEED;
+    VL53L0X_AccuracyMode profile = current_profile;
+
+    if (moving || m->filtered < PROFILE_NEAR_DISTANCE)
+        profile = VL53L0X_HIGH_SPEED;
+    else if (m->filtered > PROFILE_FAR_DISTANCE)
+        profile = VL53L0X_DEFAULT_MODE;
+
+    if (profile != current_profile) {
+        VL53L0X_stopMeasure(&device);
+        start_ranging(profile);
+        measures_since_switch = 0;
+    }
+}
+
+// alpha-beta filter of the distance and its rate of change
+static void update_measure(uint16_t range, bool valid, systime_t now) {
+    dist_measure_t m = measure;
+    float dt = ST2MS(now - m.timestamp) / 1000.0f;
+
+    if (!valid || m.seq == 0 || dt <= 0.0f) {
+        // out of range or first measure, nothing to track
+        m.filtered = range;
+        m.closing_speed = 0.0f;
+    } else {
+        float predicted = m.filtered - m.closing_speed * dt;
+        float residual = range - predicted;
+        m.filtered = predicted + DIST_ALPHA * residual;
+        m.closing_speed -= DIST_BETA * residual / dt;
+    }
+    m.distance = range;
+    m.timestamp = now;
+    m.seq++;
+
+    chSysLock();
+    measure = m;
+    chSysUnlock();
+
+    if (valid)
+        update_profile(&m);
+}
+
 static THD_WORKING_AREA(waDistanceThd, 1024);
 static THD_FUNCTION(DistanceThd, arg) {
 
@@ -28,18 +119,32 @@ static THD_FUNCTION(DistanceThd, arg) {
     (void)arg; // avoid warning for unused argument
 
     while (chThdShouldTerminateX() == false) {
-        // this updates device with the mesured range, if and only if the mesurement succeeded
-        VL53L0X_Error error = VL53L0X_getLastMeasure(&device);
-        if (error == VL53L0X_ERROR_NONE) {
-            distance = device.Data.LastRangeMeasure.RangeMilliMeter;
-
-            if (obstacle_is_close && distance > hysteresis_far_threshold)
-                obstacle_is_close = false;
-            else if (!obstacle_is_close && distance < hysteresis_close_threshold)
-                obstacle_is_close = true;
+        uint8_t ready = 0;
+        systime_t now = chVTGetSystemTime();
+
+        // only reads the sensor once a new measurement exists
+        if (VL53L0X_GetMeasurementDataReady(&device, &ready) == VL53L0X_ERROR_NONE && ready) {
+            // this updates device with the mesured range, if and only if the mesurement succeeded
+            VL53L0X_Error error = VL53L0X_getLastMeasure(&device);
+            VL53L0X_ClearInterruptMask(&device, 0);
+
+            if (error == VL53L0X_ERROR_NONE) {
+                distance = device.Data.LastRangeMeasure.RangeMilliMeter;
+                update_measure(distance, device.Data.LastRangeMeasure.RangeStatus == 0, now);
+
+                if (obstacle_is_close && distance > hysteresis_far_threshold)
+                    obstacle_is_close = false;
+                else if (!obstacle_is_close && distance < hysteresis_close_threshold)
+                    obstacle_is_close = true;
+            }
+
+            // the next one is due a budget later, in the profile update_measure
+            // may just have switched to
+            chThdSleepUntilWindowed(now, now + MS2ST(profile_budget(current_profile)
+                                                     - DIST_POLL_PERIOD));
+        } else {
+            chThdSleepMilliseconds(DIST_POLL_PERIOD);
         }
-
-        chThdSleepMilliseconds(20);
     }
 }
 
@@ -48,8 +153,7 @@ void dist_init(void) {
     device.I2cDevAddr = VL53L0X_ADDR;
 
     VL53L0X_init(&device);
-    VL53L0X_configAccuracy(&device, VL53L0X_HIGH_SPEED);
-    VL53L0X_startMeasure(&device, VL53L0X_DEVICEMODE_CONTINUOUS_RANGING);
+    start_ranging(VL53L0X_HIGH_SPEED);
 
     chThdCreateStatic(waDistanceThd, sizeof(waDistanceThd), NORMALPRIO, DistanceThd, NULL);
 }
@@ -62,3 +166,30 @@ uint16_t dist_get_distance(void) {
     return distance;
 }
 
+void dist_get_measure(dist_measure_t *m) {
+    chSysLock();
+    *m = measure;
+    chSysUnlock();
+}
+
+uint16_t dist_get_predicted_distance(uint16_t delay) {
+    dist_measure_t m;
+    dist_get_measure(&m);
+
+    uint32_t age = ST2MS(chVTGetSystemTime() - m.timestamp);
+    if (m.seq == 0 || age > DIST_STALE_AGE)
+        return m.distance;
+
+    uint32_t extrapolation = age + delay;
+    if (extrapolation > DIST_MAX_EXTRAPOLATION)
+        extrapolation = DIST_MAX_EXTRAPOLATION;
+
+    float elapsed = extrapolation / 1000.0f;
+    float predicted = m.filtered - m.closing_speed * elapsed;
+
+    if (predicted < 0.0f)
+        return 0;
+    if (predicted > UINT16_MAX)
+        return UINT16_MAX;
+    return (uint16_t)predicted;
+}
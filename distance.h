@@ -1,12 +1,36 @@
 // This is a fast and safe interface to the distance sensor.
 //
 // "Safe" means that it won't tell you that no obstacle is close if the
-// mesurement failed. "Fast" means that the data is updated every 20ms, which
-// is better than sensors/VL53L0X/VL53L0X.c, which manages to update the
-// distance only every 100ms.
+// mesurement failed. "Fast" means that a measurement is read as soon as the
+// sensor has it, about every 20ms near a wall or while moving, which is
+// better than sensors/VL53L0X/VL53L0X.c, which manages to update the
+// distance only every 100ms. Far from walls and standing still, the sensor
+// switches to its more accurate default profile.
+
+#ifndef _DISTANCE_H_
+#define _DISTANCE_H_
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <ch.h>
+
+typedef struct {
+    systime_t timestamp;    // when the measurement was read
+    uint32_t seq;           // increases by one for every measurement
+    uint16_t distance;      // [mm] as measured
+    float filtered;         // [mm] alpha-beta filtered
+    float closing_speed;    // [mm/s] positive when getting closer
+} dist_measure_t;
 
 void dist_init(void);
 bool dist_obstacle_is_close(void);
 uint16_t dist_get_distance(void);
+
+// Copies the last measurement.
+void dist_get_measure(dist_measure_t *m);
+
+// Distance expected `delay` ms from now, extrapolated at the closing speed.
+// The extrapolation is capped, and a stale measurement is returned as is.
+uint16_t dist_get_predicted_distance(uint16_t delay);
+
+#endif /* _DISTANCE_H_ */
@@ -0,0 +1,94 @@
+/**
+ * @file    goertzel.c
+ * @brief   Bank of Goertzel filters
+ */
+
+// C standard header files
+#include <math.h>
+
+// ARM headers
+#include <arm_math.h>
+
+// Module headers
+#include <goertzel.h>
+
+/*===========================================================================*/
+/*  Module exported functions                                                */
+/*===========================================================================*/
+
+void goertzel_init_bins(goertzel_bank_t *bank, uint16_t size, uint16_t hop,
+                        const uint16_t *bins, uint16_t nb_bins){
+	if(nb_bins > GOERTZEL_MAX_BINS)
+		nb_bins = GOERTZEL_MAX_BINS;
+
+	bank->hop = hop;
+	bank->nb_blocks = size / hop;
+	if(bank->nb_blocks > GOERTZEL_MAX_BLOCKS)
+		bank->nb_blocks = GOERTZEL_MAX_BLOCKS;
+	bank->count = 0;
+	bank->nb_full_blocks = 0;
+	bank->last_block = 0;
+	bank->nb_bins = nb_bins;
+
+	for(uint16_t i = 0 ; i < nb_bins ; i++){
+		float w = 2.0f * PI * bins[i] / size;
+		// reduced first, so that the angle stays accurate for high bins
+		float shift = 2.0f * PI * (((uint32_t)bins[i] * hop) % size) / size;
+
+		bank->coeff[i] = 2.0f * cosf(w);
+		bank->sin_w[i] = sinf(w);
+		bank->shift_re[i] = cosf(shift);
+		bank->shift_im[i] = -sinf(shift);
+		bank->s1[i] = 0;
+		bank->s2[i] = 0;
+	}
+}
+
+bool goertzel_feed(goertzel_bank_t *bank, int16_t sample){
+	float x = sample;
+
+	for(uint16_t i = 0 ; i < bank->nb_bins ; i++){
+		float s = x + bank->coeff[i] * bank->s1[i] - bank->s2[i];
+		bank->s2[i] = bank->s1[i];
+		bank->s1[i] = s;
+	}
+
+	if(++bank->count < bank->hop)
+		return false;
+
+	/*	The block is complete. s1 - e^(-jw)*s2 is its DFT, times
+	*	e^(jw(hop-1)), which is the same for every block and doesn't change
+	*	the magnitude of their sum.
+	*/
+	bank->count = 0;
+	bank->last_block = (bank->last_block + 1) % bank->nb_blocks;
+	for(uint16_t i = 0 ; i < bank->nb_bins ; i++){
+		bank->block_re[bank->last_block][i] = bank->s1[i] - 0.5f * bank->coeff[i] * bank->s2[i];
+		bank->block_im[bank->last_block][i] = bank->sin_w[i] * bank->s2[i];
+		bank->s1[i] = 0;
+		bank->s2[i] = 0;
+	}
+
+	if(bank->nb_full_blocks < bank->nb_blocks)
+		bank->nb_full_blocks++;
+	return bank->nb_full_blocks >= bank->nb_blocks;
+}
+
+void goertzel_magnitude(const goertzel_bank_t *bank, float *magnitude){
+	for(uint16_t i = 0 ; i < bank->nb_bins ; i++){
+		// from the newest block to the oldest, each one is a hop earlier
+		uint16_t b = bank->last_block;
+		float re = bank->block_re[b][i];
+		float im = bank->block_im[b][i];
+
+		for(uint16_t n = 1 ; n < bank->nb_blocks ; n++){
+			b = b ? b - 1 : bank->nb_blocks - 1;
+			float shifted_re = re * bank->shift_re[i] - im * bank->shift_im[i];
+			float shifted_im = re * bank->shift_im[i] + im * bank->shift_re[i];
+			re = bank->block_re[b][i] + shifted_re;
+			im = bank->block_im[b][i] + shifted_im;
+		}
+
+		arm_sqrt_f32(re * re + im * im, &magnitude[i]);
+	}
+}
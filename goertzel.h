@@ -0,0 +1,74 @@
+/**
+ * @file    goertzel.h
+ * @brief   Bank of Goertzel filters, to get a few bins of a spectrum
+ *          sample by sample, without storing the samples.
+ *
+ * The spectrum is over a window of `size` samples, and a new window ends
+ * every `hop` samples. The filters run over blocks of `hop` samples, each
+ * block gives its part of the DFT, and a window is the sum of its blocks,
+ * shifted in phase. So each bin takes one filter update per sample, however
+ * much the windows overlap.
+ */
+
+#ifndef _GOERTZEL_H_
+#define _GOERTZEL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define GOERTZEL_MAX_BINS       24
+#define GOERTZEL_MAX_BLOCKS     8
+
+/*========================================================================*/
+/*  Module data structures and types                                      */
+/*========================================================================*/
+
+typedef struct {
+	uint16_t hop;                       // samples per block
+	uint16_t nb_blocks;                 // blocks per window
+	uint16_t count;                     // samples fed in the current block
+	uint16_t nb_full_blocks;            // complete blocks, up to nb_blocks
+	uint16_t last_block;                // index of the last complete block
+	uint16_t nb_bins;
+	float coeff[GOERTZEL_MAX_BINS];     // 2cos(w)
+	float sin_w[GOERTZEL_MAX_BINS];
+	float shift_re[GOERTZEL_MAX_BINS];  // e^(-j*w*hop), from a block to the next
+	float shift_im[GOERTZEL_MAX_BINS];
+	float s1[GOERTZEL_MAX_BINS];
+	float s2[GOERTZEL_MAX_BINS];
+	// DFT of the last blocks, up to a phase common to all of them
+	float block_re[GOERTZEL_MAX_BLOCKS][GOERTZEL_MAX_BINS];
+	float block_im[GOERTZEL_MAX_BLOCKS][GOERTZEL_MAX_BINS];
+} goertzel_bank_t;
+
+/*========================================================================*/
+/*  External declarations                                                 */
+/*========================================================================*/
+
+/**
+ * @brief                   Prepares the filters for a list of bins of a
+ *                          size-point DFT, the magnitudes come out in the
+ *                          same order.
+ *
+ * @param hop               Samples between two windows, size must be a
+ *                          multiple of it, at most GOERTZEL_MAX_BLOCKS times.
+ */
+void goertzel_init_bins(goertzel_bank_t *bank, uint16_t size, uint16_t hop,
+                        const uint16_t *bins, uint16_t nb_bins);
+
+/**
+ * @brief                   Feeds one sample to every filter.
+ * @return                  true when a window is complete, get the result
+ *                          with goertzel_magnitude then.
+ */
+bool goertzel_feed(goertzel_bank_t *bank, int16_t sample);
+
+/**
+ * @brief                   Magnitude of the bins over the last window, with
+ *                          the same scale as an FFT.
+ *
+ * @param magnitude         Output, nb_bins long
+ */
+void goertzel_magnitude(const goertzel_bank_t *bank, float *magnitude);
+
+#endif /* _GOERTZEL_H_ */
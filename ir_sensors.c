@@ -29,9 +29,28 @@
 /*===========================================================================*/
 
 #define TOF_PERIOD          100
-#define IR_PERIOD           100
 
-#define NB_AVG              3
+//Filters applied to each channel
+#define IR_FILTER_NONE              0
+#define IR_FILTER_MOVING_AVERAGE    1   // mean of the last NB_AVG samples
+#define IR_FILTER_MEDIAN            2   // median of the last NB_AVG samples
+#define IR_FILTER_EXPONENTIAL       3   // y += (x - y) / 2^IR_EMA_SHIFT
+
+#ifndef IR_FILTER
+#define IR_FILTER           IR_FILTER_MEDIAN
+#endif
+
+#define NB_AVG              3   // at most MAX_NB_AVG
+#define MAX_NB_AVG          8
+#define IR_EMA_SHIFT        2
+#define IR_EMA_FRAC_BITS    8   // fractional bits of the exponential state
+
+#if NB_AVG > MAX_NB_AVG
+#error "NB_AVG is larger than MAX_NB_AVG"
+#endif
+
+//the moving average and the median keep the last NB_AVG samples
+#define IR_FILTER_HISTORY   (IR_FILTER == IR_FILTER_MOVING_AVERAGE || IR_FILTER == IR_FILTER_MEDIAN)
 
 /*===========================================================================*/
 /* Bus related declarations.                                                 */
@@ -45,7 +64,94 @@ CONDVAR_DECL(bus_condvar);
 /* Module local variables.                                                   */
 /*===========================================================================*/
 
-static proximity_msg_t prox_values = {0u};
+/*	Last sample, sequence locked. seq is odd while ir_thd updates the
+*	sample, readers copy it and start over if seq changed meanwhile. The
+*	update is also done with the kernel locked, so that a reader with a
+*	higher priority never spins on an odd seq.
+*/
+static volatile uint32_t ir_seq = 0;
+static ir_snapshot_t ir_sample = {0};
+
+//Threads waiting for the next sample
+static threads_queue_t ir_waiting;
+
+//Filter state, only used by ir_thd, and only the one of IR_FILTER
+#if IR_FILTER_HISTORY
+static uint16_t ir_history[NB_IR][NB_AVG];  // one ring per channel
+static uint8_t ir_history_index = 0;
+#endif
+#if IR_FILTER == IR_FILTER_MOVING_AVERAGE
+static uint32_t ir_history_sum[NB_IR];
+#elif IR_FILTER == IR_FILTER_EXPONENTIAL
+static uint32_t ir_ema[NB_IR];              // fixed point, IR_EMA_FRAC_BITS
+#endif
+static bool ir_filter_primed = false;
+
+/*===========================================================================*/
+/* Module local functions.                                                   */
+/*===========================================================================*/
+
+#if IR_FILTER == IR_FILTER_MEDIAN
+static uint16_t median(const uint16_t *values, uint8_t nb)
+{
+	uint16_t sorted[MAX_NB_AVG];
+
+	//insertion sort, nb is tiny
+	for(uint8_t i = 0 ; i < nb ; i++){
+		uint8_t j = i;
+		for( ; j > 0 && sorted[j - 1] > values[i] ; j--)
+			sorted[j] = sorted[j - 1];
+		sorted[j] = values[i];
+	}
+	return sorted[nb / 2];
+}
+#endif
+
+/**
+ * @brief               Adds a raw sample to the filter of every channel.
+ *
+ * @param raw           New sample of the NB_IR channels
+ * @param filtered      Receives the filtered values
+ */
+static void ir_filter(const uint16_t *raw, uint16_t *filtered)
+{
+	//the first sample fills the history, rather than zeros
+	if(!ir_filter_primed){
+		for(uint8_t c = 0 ; c < NB_IR ; c++){
+#if IR_FILTER_HISTORY
+			for(uint8_t i = 0 ; i < NB_AVG ; i++)
+				ir_history[c][i] = raw[c];
+#endif
+#if IR_FILTER == IR_FILTER_MOVING_AVERAGE
+			ir_history_sum[c] = (uint32_t)raw[c] * NB_AVG;
+#elif IR_FILTER == IR_FILTER_EXPONENTIAL
+			ir_ema[c] = (uint32_t)raw[c] << IR_EMA_FRAC_BITS;
+#endif
+		}
+		ir_filter_primed = true;
+	}
+
+	for(uint8_t c = 0 ; c < NB_IR ; c++){
+#if IR_FILTER == IR_FILTER_MOVING_AVERAGE
+		ir_history_sum[c] += raw[c] - ir_history[c][ir_history_index];
+		ir_history[c][ir_history_index] = raw[c];
+		filtered[c] = ir_history_sum[c] / NB_AVG;
+#elif IR_FILTER == IR_FILTER_MEDIAN
+		ir_history[c][ir_history_index] = raw[c];
+		filtered[c] = median(ir_history[c], NB_AVG);
+#elif IR_FILTER == IR_FILTER_EXPONENTIAL
+		int32_t error = ((int32_t)raw[c] << IR_EMA_FRAC_BITS) - (int32_t)ir_ema[c];
+		ir_ema[c] += error >> IR_EMA_SHIFT;
+		filtered[c] = ir_ema[c] >> IR_EMA_FRAC_BITS;
+#else
+		filtered[c] = raw[c];
+#endif
+	}
+
+#if IR_FILTER_HISTORY
+	ir_history_index = (ir_history_index + 1) % NB_AVG;
+#endif
+}
 
 /*===========================================================================*/
 /* Module thread pointers.                                                   */
@@ -53,17 +159,41 @@ static proximity_msg_t prox_values = {0u};
 
 static thread_t* ptr_ir_thd = NULL;
 
-static THD_WORKING_AREA(wa_ir_thd, 128);
+static THD_WORKING_AREA(wa_ir_thd, 256);
 static THD_FUNCTION(ir_thd, arg)
 {
 	chRegSetThreadName(__FUNCTION__);
 	(void)arg;
 
 	messagebus_topic_t *prox_topic = messagebus_find_topic_blocking(&bus, "/proximity");
+	proximity_msg_t prox_values;
 
 	while (chThdShouldTerminateX() == false){
+		//blocks until the next publication
 		messagebus_topic_wait(prox_topic, &prox_values, sizeof(prox_values));
-		chThdSleepMilliseconds(IR_PERIOD);
+		systime_t now = chVTGetSystemTime();
+
+		uint16_t raw[NB_IR];
+		uint16_t filtered[NB_IR];
+		for(uint8_t i = 0 ; i < NB_IR ; i++)
+			raw[i] = prox_values.delta[i];
+		ir_filter(raw, filtered);
+
+		chSysLock();
+		ir_seq++;
+		__DMB();
+		ir_sample.seq++;
+		ir_sample.timestamp = now;
+		for(uint8_t i = 0 ; i < NB_IR ; i++){
+			ir_sample.delta[i] = raw[i];
+			ir_sample.filtered[i] = filtered[i];
+		}
+		__DMB();
+		ir_seq++;
+
+		chThdDequeueAllI(&ir_waiting, MSG_OK);
+		chSchRescheduleS();
+		chSysUnlock();
 	}
 
 	chThdExit(0);
@@ -82,11 +212,42 @@ static void ir_create_thd(void)
 void sensors_init(void)
 {
 	messagebus_init(&bus, &bus_lock, &bus_condvar);
+	chThdQueueObjectInit(&ir_waiting);
 	proximity_start();
 	ir_create_thd();
 }
 
 uint16_t get_ir_delta(ir_id_t ir_number)
 {
-	return prox_values.delta[ir_number];
+	return ir_sample.delta[ir_number];
+}
+
+uint16_t get_ir_filtered(ir_id_t ir_number)
+{
+	return ir_sample.filtered[ir_number];
+}
+
+void get_ir_snapshot(ir_snapshot_t *snapshot)
+{
+	uint32_t seq;
+
+	do {
+		seq = ir_seq;
+		__DMB();
+		*snapshot = ir_sample;
+		__DMB();
+	} while ((seq & 1) || seq != ir_seq);
+}
+
+bool wait_ir_snapshot(ir_snapshot_t *snapshot, uint32_t seq, systime_t timeout)
+{
+	msg_t msg = MSG_OK;
+
+	chSysLock();
+	while (ir_sample.seq <= seq && msg == MSG_OK)
+		msg = chThdEnqueueTimeoutS(&ir_waiting, timeout);
+	chSysUnlock();
+
+	get_ir_snapshot(snapshot);
+	return snapshot->seq > seq;
 }
@@ -1,6 +1,12 @@
 #ifndef _SENSORS_H_
 #define _SENSORS_H_
 
+#include <stdbool.h>
+#include <stdint.h>
+#include <ch.h>
+
+#define NB_IR               8
+
 /*===========================================================================*/
 /*  Module data structures and types                                         */
 /*===========================================================================*/
@@ -16,6 +22,13 @@ typedef enum ir_id_t {
 	IR8,
 } ir_id_t;
 
+typedef struct {
+	uint32_t seq;           // increases by one for every new sample
+	systime_t timestamp;    // when the sample was published
+	uint16_t delta[NB_IR];      // raw
+	uint16_t filtered[NB_IR];   // through the filter of ir_sensors.c
+} ir_snapshot_t;
+
 /*========================================================================*/
 /*  External declarations                                                 */
 /*========================================================================*/
@@ -23,5 +36,21 @@ typedef enum ir_id_t {
 void sensors_init(void);
 
 uint16_t get_ir_delta(ir_id_t ir_number);
+uint16_t get_ir_filtered(ir_id_t ir_number);
+
+/**
+ * @brief           Copies the last sample of all the channels at once.
+ */
+void get_ir_snapshot(ir_snapshot_t *snapshot);
+
+/**
+ * @brief           Waits for a sample newer than seq, then copies it.
+ *
+ * @param seq       Sequence number of the last sample seen by the caller.
+ * @param timeout   Maximum time to wait, or TIME_INFINITE.
+ * @return          false if no newer sample came in time, snapshot then
+ *                  holds the last one anyway.
+ */
+bool wait_ir_snapshot(ir_snapshot_t *snapshot, uint32_t seq, systime_t timeout);
 
 #endif /* _SENSORS_H_ */
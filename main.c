@@ -31,6 +31,9 @@
 #include <distance.h>
 #include <communication.h>
 #include <action_queue.h>
+#include <maze_graph.h>
+#include <thread_profiler.h>
+#include <odometry.h>
 //#include <lfr_regulator.h>
 //#include <image_processing.h>
 
@@ -63,6 +66,8 @@ static void init_all(void){
 	mpu_init();
 
 	com_serial_start();
+	profiler_start();
+	restore_saved_path();
 	//  usb_start(); if not using bluetooth
 
 	create_mic_selector_thd();
@@ -71,16 +76,15 @@ static void init_all(void){
 	dist_init();
 	sensors_init();
 	create_corridor_navigation_thd();
+	odometry_start();
 }
 
 static bool check_asks_for_replay_of_saved_actions(void) {
 	bool is_on = get_selector() >= 8;
 	static bool saved_value = true;
-	if (is_on && !saved_value) {
-		saved_value = true;
-		return true;
-	}
-	return false;
+	bool rising_edge = is_on && !saved_value;
+	saved_value = is_on;
+	return rising_edge;
 }
 
 /*===========================================================================*/
@@ -93,12 +97,22 @@ int main(void)
 	chThdSleepMilliseconds(2000);
 	while (true) {
 		if (check_asks_for_replay_of_saved_actions()) {
-			static action_t saved_path[SAVED_PATH_SIZE+1];
-			// reset saved path and enqueue the saved actions
-			get_simplified_saved_path(saved_path);
+			static action_t route[MAZE_GRAPH_MAX_ROUTE];
+			uint16_t route_len = maze_graph_shortest_route(route, MAZE_GRAPH_MAX_ROUTE);
+
+			// enqueue the shortest route, or the saved actions if we don't
+			// know the maze (e.g. after a reboot), then reset saved path
+			if (route_len) {
+				for (uint16_t i = 0; i < route_len; i++)
+					action_queue_push(route[i]);
+			} else {
+				action_iterator_t saved_path;
+				get_simplified_saved_path(&saved_path);
+				for (action_t action; (action = action_iterator_next(&saved_path));)
+					action_queue_push(action);
+			}
 			reset_saved_path();
-			for (action_t *action = saved_path; *action; action++)
-				action_queue_push(*action);
+			maze_graph_reset();
 		}
 		control_maze();
 	}
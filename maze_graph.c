@@ -0,0 +1,185 @@
+/**
+ * @file    maze_graph.c
+ * @brief   Map of the maze, and shortest routes in it
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+// Module headers
+#include "action_queue.h"
+#include "maze_graph.h"
+
+/*===========================================================================*/
+/* Module constants.                                                         */
+/*===========================================================================*/
+
+#define NODE_MATCH_TOLERANCE    400 // [steps], about 5cm
+#define NO_NODE                 -1
+#define NB_HEADINGS             4
+
+// headings, clockwise
+#define NORTH                   0
+#define EAST                    1
+#define SOUTH                   2
+#define WEST                    3
+
+static const int8_t heading_dx[NB_HEADINGS] = { 0, 1, 0, -1 };
+static const int8_t heading_dy[NB_HEADINGS] = { 1, 0, -1, 0 };
+
+/*===========================================================================*/
+/* Module local variables.                                                   */
+/*===========================================================================*/
+
+typedef struct {
+	int32_t x, y;                       // [steps] from the start
+	int16_t neighbour[NB_HEADINGS];     // node reached going that way
+	int32_t length[NB_HEADINGS];        // [steps] to get there
+} maze_node_t;
+
+static maze_node_t nodes[MAZE_GRAPH_MAX_NODES];
+static uint16_t nb_nodes;
+static int16_t current_node;
+static uint8_t current_heading;
+
+/*===========================================================================*/
+/* Module local functions.                                                   */
+/*===========================================================================*/
+
+static int16_t find_or_add_node(int32_t x, int32_t y) {
+	for (int16_t i = 0; i < nb_nodes; i++) {
+		if (labs(nodes[i].x - x) <= NODE_MATCH_TOLERANCE
+		    && labs(nodes[i].y - y) <= NODE_MATCH_TOLERANCE)
+			return i;
+	}
+
+	if (nb_nodes >= MAZE_GRAPH_MAX_NODES)
+		return NO_NODE;
+
+	maze_node_t *node = &nodes[nb_nodes];
+	node->x = x;
+	node->y = y;
+	for (uint8_t h = 0; h < NB_HEADINGS; h++)
+		node->neighbour[h] = NO_NODE;
+	return nb_nodes++;
+}
+
+static void link_nodes(int16_t from, int16_t to, uint8_t heading, int32_t length) {
+	uint8_t back = (heading + 2) % NB_HEADINGS;
+
+	// keep the shortest measure if we already went through there
+	if (nodes[from].neighbour[heading] == to && nodes[from].length[heading] <= length)
+		return;
+
+	nodes[from].neighbour[heading] = to;
+	nodes[from].length[heading] = length;
+	nodes[to].neighbour[back] = from;
+	nodes[to].length[back] = length;
+}
+
+/*===========================================================================*/
+/* Module exported functions.                                                */
+/*===========================================================================*/
+
+void maze_graph_reset(void) {
+	nb_nodes = 0;
+	current_heading = NORTH;
+	current_node = find_or_add_node(0, 0);
+}
+
+void maze_graph_record(action_t action, int32_t length) {
+	if (!nb_nodes)
+		maze_graph_reset();
+
+	switch (action) {
+	case ACTION_LEFT:
+		current_heading = (current_heading + 3) % NB_HEADINGS;
+		break;
+	case ACTION_RIGHT:
+		current_heading = (current_heading + 1) % NB_HEADINGS;
+		break;
+	case ACTION_BACK:
+		current_heading = (current_heading + 2) % NB_HEADINGS;
+		break;
+	case ACTION_STRAIGHT: {
+		if (current_node == NO_NODE)
+			break; // we got lost because the graph is full
+		int32_t x = nodes[current_node].x + heading_dx[current_heading] * length;
+		int32_t y = nodes[current_node].y + heading_dy[current_heading] * length;
+		int16_t next = find_or_add_node(x, y);
+		if (next != NO_NODE && next != current_node)
+			link_nodes(current_node, next, current_heading, length);
+		current_node = next;
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+uint16_t maze_graph_shortest_route(action_t *route, uint16_t max_len) {
+	static int32_t distance[MAZE_GRAPH_MAX_NODES];
+	static int16_t previous[MAZE_GRAPH_MAX_NODES];
+	static uint8_t previous_heading[MAZE_GRAPH_MAX_NODES];
+	static bool done[MAZE_GRAPH_MAX_NODES];
+
+	if (!nb_nodes || current_node == NO_NODE || current_node == 0)
+		return 0;
+
+	// Dijkstra, the graph is small enough not to bother with a heap
+	for (uint16_t i = 0; i < nb_nodes; i++) {
+		distance[i] = INT32_MAX;
+		previous[i] = NO_NODE;
+		done[i] = false;
+	}
+	distance[0] = 0;
+
+	while (true) {
+		int16_t u = NO_NODE;
+		for (int16_t i = 0; i < nb_nodes; i++)
+			if (!done[i] && distance[i] != INT32_MAX && (u == NO_NODE || distance[i] < distance[u]))
+				u = i;
+		if (u == NO_NODE || u == current_node)
+			break;
+		done[u] = true;
+
+		for (uint8_t h = 0; h < NB_HEADINGS; h++) {
+			int16_t v = nodes[u].neighbour[h];
+			if (v == NO_NODE || done[v])
+				continue;
+			if (distance[u] + nodes[u].length[h] < distance[v]) {
+				distance[v] = distance[u] + nodes[u].length[h];
+				previous[v] = u;
+				previous_heading[v] = h;
+			}
+		}
+	}
+
+	if (distance[current_node] == INT32_MAX)
+		return 0;
+
+	// walk back from the goal to find the headings to follow
+	static uint8_t headings[MAZE_GRAPH_MAX_NODES];
+	uint16_t nb_headings = 0;
+	for (int16_t v = current_node; v != 0; v = previous[v])
+		headings[nb_headings++] = previous_heading[v];
+
+	// turn them into actions, the same way they are recorded while exploring
+	static const action_t turns[NB_HEADINGS] = {
+		ACTION_VOID, ACTION_RIGHT, ACTION_BACK, ACTION_LEFT,
+	};
+	uint8_t heading = NORTH;
+	uint16_t len = 0;
+	while (nb_headings--) {
+		uint8_t next_heading = headings[nb_headings];
+		action_t turn = turns[(next_heading - heading + NB_HEADINGS) % NB_HEADINGS];
+		if (len + (turn ? 2 : 1) > max_len)
+			return 0;
+		if (turn)
+			route[len++] = turn;
+		route[len++] = ACTION_STRAIGHT;
+		heading = next_heading;
+	}
+	return len;
+}
@@ -0,0 +1,48 @@
+/**
+ * @file    maze_graph.h
+ * @brief   Map of the maze built from the executed actions.
+ *
+ * Every place where a corridor ends is a node, located by dead reckoning from
+ * the start. Nodes closer than NODE_MATCH_TOLERANCE are considered to be the
+ * same, so the graph also knows about loops, unlike simplify_action_list.
+ */
+
+#ifndef _MAZE_GRAPH_H_
+#define _MAZE_GRAPH_H_
+
+#include <stdint.h>
+
+#include "action_queue.h"
+
+#define MAZE_GRAPH_MAX_NODES    128
+// a route takes at most a turn and a corridor per node
+#define MAZE_GRAPH_MAX_ROUTE    (2 * MAZE_GRAPH_MAX_NODES)
+
+/*===========================================================================*/
+/*  External declarations                                                    */
+/*===========================================================================*/
+
+/**
+ * @brief           Forgets the maze, the current place becomes the start.
+ */
+void maze_graph_reset(void);
+
+/**
+ * @brief           Updates the graph with an action that was just executed.
+ *
+ * @param action    The executed action.
+ * @param length    For ACTION_STRAIGHT, the length of the corridor in motor steps.
+ */
+void maze_graph_record(action_t action, int32_t length);
+
+/**
+ * @brief           Finds the shortest route from the start to the current place.
+ *
+ * @param route     Filled with the actions to follow, starting with the
+ *                  heading the robot had at the start.
+ * @param max_len   Size of `route`, MAZE_GRAPH_MAX_ROUTE is always enough.
+ * @return          The number of actions, 0 if there is no route.
+ */
+uint16_t maze_graph_shortest_route(action_t *route, uint16_t max_len);
+
+#endif /* _MAZE_GRAPH_H_ */
@@ -1,48 +1,153 @@
+#include <math.h>
+
 #include "action_queue.h"
 #include "move_command.h"
 #include "corridor_navigation.h"
 #include "distance.h"
 #include "ir_sensors.h"
+#include "maze_graph.h"
 
 #include "selector.h"
 #include "leds.h"
 
-static void execute_action(action_t action) {
+// how long to wait for a command when we don't know what to do, in milliseconds
+#define STUCK_TIMEOUT 100
+// how far the centre of a junction is past the end of the side walls, in cm
+#define JUNCTION_CENTRE 2.75f
+// how far into a corridor the robot goes before following its walls, in cm
+#define CORRIDOR_ENTRY 4.0f
+// speed at which the corridor takes over from the entry, in steps/s
+#define CORRIDOR_ENTRY_SPEED DEFAULT_SPEED
+// chain the queued actions without stopping at the junctions, turning along arcs
+#define CONTINUOUS_MOTION true
+// how far past the axis of the next corridor an arc may end, in cm
+#define ARC_AXIS_TOLERANCE 1.5f
+// an arc started `lead` before the centre of the junction ends past the axis of
+// the next corridor by its radius minus `lead`, so closer than this, in cm, the
+// radius is clamped too far above it and the robot stops and turns in place.
+// It is below JUNCTION_CENTRE, so that arcs can start where the side walls end.
+#define ARC_MIN_LEAD (MIN_ARC_RADIUS - ARC_AXIS_TOLERANCE)
+
+// whether the robot is still moving from the last action to the next one, and
+// then where it is along its path from the centre of the junction, in cm, as
+// of offset_steps travelled in the current move
+static bool in_motion = false;
+static float junction_offset = 0.0f;
+static int32_t offset_steps = 0;
+
+// the robot goes on while the next action comes, adds the way since
+static void update_junction_offset(void) {
+	if (!in_motion)
+		return;
+
+	int32_t travelled = get_travelled_steps();
+	junction_offset += steps_to_distance(travelled - offset_steps);
+	offset_steps = travelled;
+}
+
+// a turn is followed by the corridor in front of us, unless the next actions
+// are already known, e.g. when replaying a path that has them
+static void follow_turn_with_corridor(void) {
+	if (action_queue_empty())
+		action_queue_push(ACTION_STRAIGHT);
+}
+
+// whether the robot may run into `next` without stopping at the junction
+static bool can_chain(action_t next) {
+	if (!CONTINUOUS_MOTION)
+		return false;
+	return next == ACTION_STRAIGHT || next == ACTION_LEFT || next == ACTION_RIGHT;
+}
+
+// stops at the centre of the junction, if still on the way
+static void come_to_rest(void) {
+	if (!in_motion)
+		return;
+
+	update_junction_offset();
+	float braking = get_braking_distance();
+	if (-junction_offset >= braking) {
+		// brakes on the way to stop right there
+		move(-junction_offset, FORWARD);
+		chBSemWait(get_motor_semaphore_ptr());
+	}
+	else {
+		// too close or already past it: brakes along the profile, then backs up
+		move(braking, FORWARD);
+		chBSemWait(get_motor_semaphore_ptr());
+		float overshoot = junction_offset + steps_to_distance(get_travelled_steps());
+		move(fabsf(overshoot), overshoot > 0.0f ? BACKWARD : FORWARD);
+		chBSemWait(get_motor_semaphore_ptr());
+	}
+	in_motion = false;
+	junction_offset = 0.0f;
+}
+
+// returns the length of the corridor for ACTION_STRAIGHT, in steps
+static int32_t execute_action(action_t action) {
+	int32_t length = 0;
+	rotation_t rotation = action == ACTION_LEFT ? COUNTERCLOCKWISE : CLOCKWISE;
+
 	switch (action) {
 	case ACTION_STRAIGHT:
-		move(4.0f, FORWARD);
+		update_junction_offset();
+		// blind until the side walls are in sight, the corridor takes over on the way
+		move_through(junction_offset < CORRIDOR_ENTRY ? CORRIDOR_ENTRY - junction_offset : 0.0f,
+		             FORWARD, CORRIDOR_ENTRY_SPEED);
 		chBSemWait(get_motor_semaphore_ptr());
 		navigate_corridor();
 		chBSemWait(get_corridor_end_detected_semaphore_ptr());
-		chBSemWait(get_motor_semaphore_ptr());
-		move(2.75f, FORWARD);
-		chBSemWait(get_motor_semaphore_ptr());
+		// measured from the centre of the junction we came from
+		length = get_travelled_steps() + distance_to_steps(junction_offset);
+		if (can_chain(action_queue_peek())) {
+			// the next action takes over on the way to the centre
+			in_motion = true;
+			junction_offset = -JUNCTION_CENTRE;
+			offset_steps = get_travelled_steps();
+			length += distance_to_steps(JUNCTION_CENTRE);
+		}
+		else {
+			in_motion = false;
+			junction_offset = 0.0f;
+			move(JUNCTION_CENTRE, FORWARD);
+			chBSemWait(get_motor_semaphore_ptr());
+			length += get_travelled_steps();
+		}
 		break;
 	case ACTION_BACK:
+		come_to_rest();
 		u_turn();
 		chBSemWait(get_motor_semaphore_ptr());
-		action_queue_push(ACTION_STRAIGHT);
+		follow_turn_with_corridor();
 		break;
 	case ACTION_LEFT:
-		right_angle_turn(COUNTERCLOCKWISE);
-		chBSemWait(get_motor_semaphore_ptr());
-		action_queue_push(ACTION_STRAIGHT);
-		break;
 	case ACTION_RIGHT:
-		right_angle_turn(CLOCKWISE);
-		chBSemWait(get_motor_semaphore_ptr());
-		action_queue_push(ACTION_STRAIGHT);
+		update_junction_offset();
+		if (in_motion && -junction_offset >= ARC_MIN_LEAD) {
+			// the arc ends as far past the centre as it starts before it, or
+			// up to ARC_AXIS_TOLERANCE further if that is too tight
+			junction_offset = arc_turn(-junction_offset, rotation);
+			chBSemWait(get_motor_semaphore_ptr());
+			offset_steps = get_travelled_steps();
+		}
+		else {
+			come_to_rest();
+			right_angle_turn(rotation);
+			chBSemWait(get_motor_semaphore_ptr());
+		}
+		follow_turn_with_corridor();
 		break;
 	default:
 		break;
 	}
+	return length;
 }
 
 // this implements a simple left-following maze solving algorithm
 static void show_next_actions(void) {
-	set_led(3, get_ir_delta(IR6) < 150);
+	set_led(3, get_ir_filtered(IR6) < 150);
 	set_led(0, dist_get_distance() > 80);
-	set_led(1, get_ir_delta(IR3) < 150);
+	set_led(1, get_ir_filtered(IR3) < 150);
 }
 
 // this implements a simple left-following maze solving algorithm
@@ -51,11 +156,14 @@ static action_t find_next_action(void) {
 	if (!is_auto_feature_enabled)
 		return ACTION_VOID;
 
-	if (get_ir_delta(IR6) < 150)
+	ir_snapshot_t ir;
+	get_ir_snapshot(&ir);
+
+	if (ir.filtered[IR6] < 150)
 		return ACTION_LEFT;
 	if (dist_get_distance() > 80)
 		return ACTION_STRAIGHT;
-	if (get_ir_delta(IR3) < 150)
+	if (ir.filtered[IR3] < 150)
 		return ACTION_RIGHT;
 	return ACTION_BACK;
 }
@@ -65,16 +173,24 @@ void control_maze(void) {
 
 	action_t current_action = ACTION_VOID;
 	if (!(current_action = action_queue_pop())) {
+		// nothing more was queued, finish the way to the junction before looking
+		come_to_rest();
+		// the robot is stopped, so it may stall while the journal is rewritten
+		saved_path_flush();
 		if (!(current_action = find_next_action())) {
-			// signal that we are stuck
+			// signal that we are stuck, and wait for a command to come in
 			set_front_led(1);
-			chThdSleepMilliseconds(10);
+			current_action = action_queue_pop_timeout(MS2ST(STUCK_TIMEOUT));
 		}
 	}
 
 	set_front_led(0);
 
-	// save and execute this action
-	saved_path_push(current_action);
-	execute_action(current_action);
+	if (!current_action)
+		return; // give the caller a chance to check for a replay request
+
+	// save and execute this action, the body led tells when the saved path is full
+	set_body_led(!saved_path_push(current_action));
+	int32_t length = execute_action(current_action);
+	maze_graph_record(current_action, length);
 }
@@ -0,0 +1,283 @@
+/**
+ * @file    mic_detection.c
+ * @brief   Detection of the sound commands in the mic samples
+ */
+
+// C standard headers
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// ARM headers
+#include <arm_math.h>
+
+// Module headers
+#include "mic_detection.h"
+#include "arm_fft.h"
+#include "goertzel.h"
+#include "tone_protocol.h"
+
+/*===========================================================================*/
+/* Module constants.                                                         */
+/*===========================================================================*/
+
+//FFT constants
+//The four mics are averaged, which halves the uncorrelated noise floor
+#define MIN_VALUE_THRESHOLD		5000
+#define FFT_SIZE 				1024
+//A new analysis window starts every FFT_HOP_SIZE samples, so consecutive
+//windows overlap. It must divide FFT_SIZE, FFT_SIZE means no overlap.
+#define FFT_HOP_SIZE			(FFT_SIZE / 4)
+#define NB_WINDOWS				(FFT_SIZE / FFT_HOP_SIZE)
+//Number of windows without any sample in common that must agree before a
+//command is added. Overlapping windows share most of their noise, so all the
+//consecutive windows in between must agree as well.
+#define NB_INDEPENDENT_VOTES	2
+#define NB_VOTES				((NB_INDEPENDENT_VOTES - 1) * NB_WINDOWS + 1)
+
+//Reduce the frequency range for efficency
+#define MIN_FREQ        		10
+#define MAX_FREQ        		30
+#define NB_FREQ         		(MAX_FREQ - MIN_FREQ + 1)
+
+//Frequencies attributed to command
+#define FREQ_U_TURN     		20
+#define FREQ_TURN_LEFT  		22
+#define FREQ_TURN_RIGHT 		24
+#define FREQ_STRAIGHT   		26
+
+//Frequencies ranges (attributed to center frequency plus minus one,
+//the bin between two commands goes to the lower one)
+#define FREQ_U_TURN_LOW         (FREQ_U_TURN-1)
+#define FREQ_U_TURN_HIGH        (FREQ_U_TURN+1)
+#define FREQ_TURN_LEFT_LOW      (FREQ_TURN_LEFT-1)
+#define FREQ_TURN_LEFT_HIGH     (FREQ_TURN_LEFT+1)
+#define FREQ_TURN_RIGHT_LOW     (FREQ_TURN_RIGHT-1)
+#define FREQ_TURN_RIGHT_HIGH    (FREQ_TURN_RIGHT+1)
+#define FREQ_STRAIGHT_LOW       (FREQ_STRAIGHT-1)
+#define FREQ_STRAIGHT_HIGH      (FREQ_STRAIGHT+1)
+
+//Bins followed by the Goertzel filters, enough for all the commands
+#define GOERTZEL_MIN_FREQ       FREQ_U_TURN_LOW
+#define GOERTZEL_MAX_FREQ       FREQ_STRAIGHT_HIGH
+#define GOERTZEL_NB_FREQ        (GOERTZEL_MAX_FREQ - GOERTZEL_MIN_FREQ + 1)
+//followed by the bins of the dual tone symbols
+#define GOERTZEL_NB_BINS        (GOERTZEL_NB_FREQ + TONE_NB_BINS)
+
+//A dual tone frame is dropped after this long without a new symbol
+#define TONE_FRAME_TIMEOUT      2000	// [ms]
+#define TONE_FRAME_TIMEOUT_WINDOWS	\
+	(TONE_FRAME_TIMEOUT * (MIC_SAMPLE_RATE / 1000) / FFT_HOP_SIZE)
+
+/*===========================================================================*/
+/* Module local variables.                                                   */
+/*===========================================================================*/
+
+//Where the detected actions go, given to mic_detection_init
+static void (*push_action)(action_t) = NULL;
+
+//Last detections of mic_remote
+static action_t last_identified_frequencies[NB_VOTES];
+static uint8_t last_identified_frequencies_index = 0;
+static action_t last_added_action = ACTION_VOID;
+
+#if MIC_DETECTION_MODE == MIC_DETECTION_GOERTZEL
+_Static_assert(NB_WINDOWS <= GOERTZEL_MAX_BLOCKS, "too many windows in flight for the Goertzel bank");
+
+static goertzel_bank_t goertzel_bank;
+#else
+_Static_assert(FFT_SIZE_IS_SUPPORTED(FFT_SIZE), "FFT_BACKEND doesn't support FFT_SIZE");
+
+//Samples since the last window
+static uint16_t hop_count = 0;
+//Last FFT_SIZE fused samples
+static int16_t mic_ring[FFT_SIZE];
+static uint16_t ring_index = 0;
+static bool ring_full = false;
+#endif
+
+/*===========================================================================*/
+/* Module local functions.                                                   */
+/*===========================================================================*/
+
+static action_t identify_frequency(uint16_t freq) {
+	if(freq >= FREQ_U_TURN_LOW &&
+	   freq <= FREQ_U_TURN_HIGH){
+		return ACTION_BACK;
+	}
+	else if(freq >= FREQ_TURN_LEFT_LOW &&
+	   freq <= FREQ_TURN_LEFT_HIGH){
+		return ACTION_LEFT;
+	}
+	else if(freq >= FREQ_TURN_RIGHT_LOW &&
+	   freq <= FREQ_TURN_RIGHT_HIGH){
+		return ACTION_RIGHT;
+	}
+	else if(freq >= FREQ_STRAIGHT_LOW &&
+	   freq <= FREQ_STRAIGHT_HIGH){
+		return ACTION_STRAIGHT;
+	}
+	return ACTION_VOID;
+}
+
+/**
+ * @brief               Turns the spectrum into commands
+ *
+ * @param first_bin     Bin of data[0]
+ * @param nb_bins       Number of bins in data
+ * @param data          Magnitude of the bins
+ */
+static void mic_remote(uint16_t first_bin, uint16_t nb_bins, const float* data){
+	float max_norm = MIN_VALUE_THRESHOLD;
+	int16_t max_norm_index = 0;
+
+	//search for the highest peak
+	for(uint16_t i = 0 ; i < nb_bins ; i++){
+		if(data[i] > max_norm){
+			max_norm = data[i];
+			max_norm_index = first_bin + i;
+		}
+	}
+
+	static const size_t last_identified_frequencies_len = sizeof(last_identified_frequencies) / sizeof(*last_identified_frequencies);
+
+	last_identified_frequencies[last_identified_frequencies_index++] = identify_frequency(max_norm_index);
+	last_identified_frequencies_index %= last_identified_frequencies_len;
+
+	for (size_t i = 1; i < last_identified_frequencies_len; i++) {
+			if (last_identified_frequencies[0] != last_identified_frequencies[i])
+					return; // nothing to do, not all the previous freq are equal
+	}
+
+	// last_identified_frequencies are all equal
+
+	if (last_identified_frequencies[0] != last_added_action) {
+		last_added_action = last_identified_frequencies[0];
+		push_action(last_added_action);
+	}
+}
+
+/**
+ * @brief               Looks for a dual tone symbol first, then for a
+ *                      single tone command
+ *
+ * @param first_bin     Bin of data[0]
+ * @param nb_bins       Number of bins in data
+ * @param data          Magnitude of the single tone command bins
+ * @param tone_data     Magnitude of tone_protocol_bins
+ */
+static void detect_commands(uint16_t first_bin, uint16_t nb_bins,
+                            const float *data, const float *tone_data){
+	//the dual tones leak into the command bins, ignore them during a frame
+	if(!tone_protocol_window(tone_data, MIN_VALUE_THRESHOLD))
+		mic_remote(first_bin, nb_bins, data);
+}
+
+/*===========================================================================*/
+/* Module exported functions.                                                */
+/*===========================================================================*/
+
+void mic_detection_init(void (*push)(action_t)){
+	push_action = push;
+
+	for(uint8_t i = 0 ; i < NB_VOTES ; i++)
+		last_identified_frequencies[i] = ACTION_VOID;
+	last_identified_frequencies_index = 0;
+	last_added_action = ACTION_VOID;
+
+#if MIC_DETECTION_MODE == MIC_DETECTION_GOERTZEL
+	uint16_t bins[GOERTZEL_NB_BINS];
+	for(uint16_t i = 0 ; i < GOERTZEL_NB_FREQ ; i++)
+		bins[i] = GOERTZEL_MIN_FREQ + i;
+	for(uint16_t i = 0 ; i < TONE_NB_BINS ; i++)
+		bins[GOERTZEL_NB_FREQ + i] = tone_protocol_bins[i];
+
+	goertzel_init_bins(&goertzel_bank, FFT_SIZE, FFT_HOP_SIZE, bins, GOERTZEL_NB_BINS);
+#else
+	hop_count = 0;
+	ring_index = 0;
+	ring_full = false;
+#endif
+	tone_protocol_reset(TONE_FRAME_TIMEOUT_WINDOWS, push);
+}
+
+void mic_detection_fuse(const int16_t *data, uint16_t num_samples, int16_t *fused){
+	/*	The command tones are a few hundred Hz, their wavelength is much
+	*	longer than the distance between the mics, so they reach the four
+	*	mics in phase and a plain sum keeps them intact while the
+	*	uncorrelated noise partly cancels. Each sample is two words (R,L)
+	*	and (B,F), added with halving SIMD instructions so it cannot
+	*	overflow.
+	*/
+	const uint32_t *pairs = (const uint32_t*)data;
+
+	for(uint16_t i = 0 ; i < num_samples / 4 ; i++){
+		//(L+F)/2 in the upper half, (R+B)/2 in the lower half
+		uint32_t halves = __SHADD16(pairs[2*i], pairs[2*i + 1]);
+		//adds both halves
+		fused[i] = (int16_t)(((int32_t)__SMUAD(halves, 0x00010001)) >> 1);
+	}
+}
+
+void mic_detection_process(const int16_t *samples, uint16_t num_samples){
+	/*  We get 160 samples per mic every 10ms. Every FFT_HOP_SIZE samples,
+	 *  we look at the spectrum of the last FFT_SIZE samples.
+	 */
+#if MIC_DETECTION_MODE == MIC_DETECTION_GOERTZEL
+	/*	The filters are updated with every sample, over blocks of
+	*	FFT_HOP_SIZE samples. Each block gives its part of the spectrum, and
+	*	the last NB_WINDOWS of them add up to the spectrum of the last
+	*	FFT_SIZE samples. So there is one filter per bin whatever the
+	*	overlap, no frame to store, and no sample is dropped.
+	*/
+	static float mic_output[GOERTZEL_NB_BINS];
+
+	for(uint16_t i = 0 ; i < num_samples ; i++){
+		if(goertzel_feed(&goertzel_bank, samples[i])){
+			goertzel_magnitude(&goertzel_bank, mic_output);
+			detect_commands(GOERTZEL_MIN_FREQ, GOERTZEL_NB_FREQ, mic_output,
+			                &mic_output[GOERTZEL_NB_FREQ]);
+		}
+	}
+
+#else
+	//The window being analysed, the FFT backend may modify it
+	static int16_t mic_samples[FFT_SIZE];
+	//Magnitude of the bins we are interested in
+	static float mic_output[NB_FREQ];
+	static float tone_output[TONE_NB_BINS];
+
+	for(uint16_t i = 0 ; i < num_samples ; i++){
+		mic_ring[ring_index++] = samples[i];
+		if(ring_index >= FFT_SIZE){
+			ring_index = 0;
+			ring_full = true;
+		}
+
+		if(++hop_count < FFT_HOP_SIZE || !ring_full)
+			continue;
+		hop_count = 0;
+
+		//unroll the ring, oldest sample first
+		memcpy(mic_samples, &mic_ring[ring_index],
+		       (FFT_SIZE - ring_index) * sizeof(int16_t));
+		memcpy(&mic_samples[FFT_SIZE - ring_index], mic_ring,
+		       ring_index * sizeof(int16_t));
+
+		/*	FFT proccessing
+		*
+		*	The backend is selected in arm_fft.h, it keeps the spectrum
+		*	internally, so we only ask for the magnitude of the bins
+		*	mic_remote looks at. If it fails, the window is skipped rather
+		*	than read from the spectrum of the previous one.
+		*/
+		if(!fft_compute(FFT_SIZE, mic_samples))
+			continue;
+		fft_band_magnitude(MIN_FREQ, NB_FREQ, mic_output);
+		for(uint16_t t = 0 ; t < TONE_NB_BINS ; t++)
+			fft_band_magnitude(tone_protocol_bins[t], 1, &tone_output[t]);
+
+		detect_commands(MIN_FREQ, NB_FREQ, mic_output, tone_output);
+	}
+#endif
+}
@@ -0,0 +1,57 @@
+/**
+ * @file    mic_detection.h
+ * @brief   Detection of the sound commands in the mic samples.
+ *
+ * Only depends on the DSP code and on the action sink it is given, not on
+ * ChibiOS or the mic driver, so recorded samples can be run through exactly
+ * the same code as on the robot.
+ */
+
+#ifndef _MIC_DETECTION_H_
+#define _MIC_DETECTION_H_
+
+#include <stdint.h>
+
+#include "action.h"
+
+#define MIC_SAMPLE_RATE         16000   // [Hz]
+
+//Detection modes
+#define MIC_DETECTION_FFT       0   // spectrum of whole frames
+#define MIC_DETECTION_GOERTZEL  1   // only the command bins, sample by sample
+
+#ifndef MIC_DETECTION_MODE
+#define MIC_DETECTION_MODE      MIC_DETECTION_GOERTZEL
+#endif
+
+/*===========================================================================*/
+/*  External declarations                                                    */
+/*===========================================================================*/
+
+/**
+ * @brief               Starts the detection from scratch, call it first.
+ *
+ * @param push          Called with every detected action, in order, from the
+ *                      context of mic_detection_process. On the robot it is
+ *                      action_queue_push.
+ */
+void mic_detection_init(void (*push)(action_t));
+
+/**
+ * @brief               Averages the four microphones into a single channel.
+ *
+ * @param data          Interleaved samples of the four mics, word aligned
+ * @param num_samples   Number of values in data (4 per sample)
+ * @param fused         Receives num_samples/4 samples
+ */
+void mic_detection_fuse(const int16_t *data, uint16_t num_samples, int16_t *fused);
+
+/**
+ * @brief               Looks for commands in the next block of samples.
+ *
+ * @param samples       Fused samples, or the samples of a single mic
+ * @param num_samples   Number of samples in the block, any size works
+ */
+void mic_detection_process(const int16_t *samples, uint16_t num_samples);
+
+#endif /* _MIC_DETECTION_H_ */
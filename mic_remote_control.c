@@ -14,13 +14,10 @@
 #include <audio/microphone.h>
 #include <selector.h>
 
-// ARM headers
-#include <arm_math.h>
-
 // Module headers
 #include "action_queue.h"
 #include "mic_remote_control.h"
-#include "arm_fft.h"
+#include "mic_detection.h"
 #include "move_command.h"
 
 /*===========================================================================*/
@@ -28,30 +25,31 @@
 /*===========================================================================*/
 
 #define MIC_SELECTOR_PERIOD		1000	// [ms]
-
-//FFT constants
-#define MIN_VALUE_THRESHOLD		10000
-#define FFT_SIZE 				1024
-
-//Reduce the frequency range for efficency
-#define MIN_FREQ        		10
-#define MAX_FREQ        		30
-
-//Frequencies attributed to command
-#define FREQ_U_TURN     		20
-#define FREQ_TURN_LEFT  		22
-#define FREQ_TURN_RIGHT 		24
-#define FREQ_STRAIGHT   		26
-
-//Frequencies ranges (attributed to center frequency plus minus one)
-#define FREQ_U_TURN_LOW         (FREQ_U_TURN-2)
-#define FREQ_U_TURN_HIGH        (FREQ_U_TURN+2)
-#define FREQ_TURN_LEFT_LOW      (FREQ_TURN_LEFT-2)
-#define FREQ_TURN_LEFT_HIGH     (FREQ_TURN_LEFT+2)
-#define FREQ_TURN_RIGHT_LOW     (FREQ_TURN_RIGHT-2)
-#define FREQ_TURN_RIGHT_HIGH    (FREQ_TURN_RIGHT+2)
-#define FREQ_STRAIGHT_LOW       (FREQ_STRAIGHT-2)
-#define FREQ_STRAIGHT_HIGH      (FREQ_STRAIGHT+2)
+//Wakes the selector thread when it is paused, resumed or stopped
+#define SELECTOR_EVT_WAKE		EVENT_MASK(0)
+#define MIC_BLOCK_SIZE			160		// samples per mic in each callback
+#define MIC_NB_BUFFERS			4		// fused blocks waiting for dsp_thd
+//Below the navigation threads, the buffers absorb the delay
+#define DSP_THD_PRIO			(NORMALPRIO - 1)
+#define CYCLES_PER_US			(STM32_SYSCLK / 1000000)
+
+/*	Stacks, from the deepest call chains measured with -fstack-usage (on the
+*	host, whose frames are wider than Thumb-2 ones) with about 2x margin.
+*	The "stk free" column of the thread profiler checks them on the robot.
+*	- dsp_thd, Goertzel: mic_detection_process, tone_protocol_window and
+*	  action_queue_push, ~250 bytes with the kernel calls.
+*	- dsp_thd, FFT: mic_detection_process and fft_compute take ~160 bytes,
+*	  plus the CMSIS radix-8 butterflies, which spill most of their registers.
+*	- thd_mic_selector: get_selector and chEvtWaitAnyTimeout, ~80 bytes. The
+*	  detection is set up before the thread starts, goertzel_init_bins calls
+*	  cosf and mic_detection_init keeps the list of bins on the stack.
+*/
+#if MIC_DETECTION_MODE == MIC_DETECTION_FFT
+#define DSP_THD_STACK			1024
+#else
+#define DSP_THD_STACK			512
+#endif
+#define MIC_SELECTOR_THD_STACK	128
 
 /*===========================================================================*/
 /* Module local variables.                                                   */
@@ -64,154 +62,110 @@ static bool selector_thd_paused = false;
 //Mic disable flag
 static bool disable_mic = true;	// disable callback function
 
+//Fused blocks handed from the mic callback to dsp_thd, by index
+static int16_t mic_buffers[MIC_NB_BUFFERS][MIC_BLOCK_SIZE];
+static msg_t dsp_mailbox_buffer[MIC_NB_BUFFERS];
+static MAILBOX_DECL(dsp_mailbox, dsp_mailbox_buffer, MIC_NB_BUFFERS);
+static uint8_t mic_blocks_in_flight = 0;
+static uint32_t mic_dropped_blocks = 0;
+
+//Time taken by dsp_thd for each block
+static time_measurement_t dsp_time;
+
 /*===========================================================================*/
 /* Module thread pointers                                                    */
 /*===========================================================================*/
 
 static thread_t *ptr_mic_selector_thd = NULL;
+static thread_t *ptr_dsp_thd = NULL;
 
 /*===========================================================================*/
 /* Module local functions.                                                   */
 /*===========================================================================*/
 
-static action_t identify_frequency(uint16_t freq) {
-	if(freq >= FREQ_U_TURN_LOW &&
-	   freq <= FREQ_U_TURN_HIGH){
-		return ACTION_BACK;
-	}
-	else if(freq >= FREQ_TURN_LEFT_LOW &&
-	   freq <= FREQ_TURN_LEFT_HIGH){
-		return ACTION_LEFT;
-	}
-	else if(freq >= FREQ_TURN_RIGHT_LOW &&
-	   freq <= FREQ_TURN_RIGHT_HIGH){
-		return ACTION_RIGHT;
-	}
-	else if(freq >= FREQ_STRAIGHT_LOW &&
-	   freq <= FREQ_STRAIGHT_HIGH){
-		return ACTION_STRAIGHT;
-	}
-	return ACTION_VOID;
-}
-
-void mic_remote(float* data){
-	float max_norm = MIN_VALUE_THRESHOLD;
-	int16_t max_norm_index = 0;
-
-	//search for the highest peak
-	for(uint16_t i = MIN_FREQ ; i <= MAX_FREQ ; i++){
-		if(data[i] > max_norm){
-			max_norm = data[i];
-			max_norm_index = i;
-		}
-	}
-
-	static action_t last_identified_frequencies[3] = {};
-	static size_t last_identified_frequencies_index = 0;
-	static const size_t last_identified_frequencies_len = sizeof(last_identified_frequencies) / sizeof(*last_identified_frequencies);
-
-	last_identified_frequencies[last_identified_frequencies_index++] = identify_frequency(max_norm_index);
-	last_identified_frequencies_index %= last_identified_frequencies_len;
-
-	for (size_t i = 1; i < last_identified_frequencies_len; i++) {
-			if (last_identified_frequencies[0] != last_identified_frequencies[i])
-					return; // nothing to do, not all the previous freq are equal
-	}
-
-	// last_identified_frequencies are all equal
-
-	static action_t last_added_action = ACTION_VOID;
-
-	if (last_identified_frequencies[0] != last_added_action) {
-		last_added_action = last_identified_frequencies[0];
-		action_queue_push(last_added_action);
-	}
-}
-
 /**
  * @brief               audio processing function taken from TP 5
- * 
+ *
+ * @details             Runs in the audio driver path, so it only fuses the
+ *                      mics into a free block buffer and hands it over to
+ *                      dsp_thd. If dsp_thd is so late that no buffer is
+ *                      free, the block is dropped and counted.
+ *
  * @param data          Buffer containing 4 times 160 mic samples.
  *                      The samples are directly sorted by the micro.
  * @param num_samples   Tells how many data we get in total (tpy:640 see above)
  */
 void process_audio_data(int16_t *data, uint16_t num_samples){
-	/*  We get 160 samples per mic every 10ms. So we fill the samples buffers
-	 *  to reach 1024 samples, then we compute the FFTs.
-	 *  Sw we fill the samples buffers to reach
-	 */
-	static uint16_t nb_samples = 0;
-	static uint8_t mustSend = 0;
-
-	//2 times FFT_SIZE because these arrays contain complex numbers
-	static float micLeft_cmplx_input[2 * FFT_SIZE];
-	//Arrays containing the computed magnitude of the complex numbers
-	static float micLeft_output[FFT_SIZE];
-
 	if(disable_mic)
 		return;
 
-	//loop to fill the buffers
-	for(uint16_t i = 0 ; i < num_samples ; i+=4){
-		//construct an array of complex numbers. Put 0 to the imaginary part
-		micLeft_cmplx_input[nb_samples++] = (float)data[i + MIC_LEFT];
-		micLeft_cmplx_input[nb_samples++] = 0;
-
-		//stop when buffer is full
-		if(nb_samples >= (2 * FFT_SIZE)){
-			break;
-		}
-	}
+	static uint8_t write_index = 0;
+	syssts_t sts = chSysGetStatusAndLockX();
+	bool full = mic_blocks_in_flight >= MIC_NB_BUFFERS;
+	if(full)
+		mic_dropped_blocks++;
+	chSysRestoreStatusX(sts);
 
-	if(nb_samples >= (2 * FFT_SIZE)){
-		/*	FFT proccessing
-		*
-		*	This FFT function stores the results in the input buffer given.
-		*	This is an "In Place" function. 
-		*/
-
-		doFFT_optimized(FFT_SIZE, micLeft_cmplx_input, micLeft_output);
+	if(full)
+		return;
 
-		/*	Magnitude processing
-		*
-		*	Computes the magnitude of the complex numbers and
-		*	stores them in a buffer of FFT_SIZE because it only contains
-		*	real numbers.
-		*/
-		//arm_cmplx_mag_f32(micLeft_cmplx_input, micLeft_output, FFT_SIZE);
+	//blocks in flight are the ones just before write_index, so it is free
+	mic_detection_fuse(data, num_samples, mic_buffers[write_index]);
 
-		nb_samples = 0;
-		mustSend++;
+	sts = chSysGetStatusAndLockX();
+	chMBPostI(&dsp_mailbox, (msg_t)write_index);
+	mic_blocks_in_flight++;
+	chSysRestoreStatusX(sts);
 
-		mic_remote(micLeft_output);
-	}
+	write_index = (write_index + 1) % MIC_NB_BUFFERS;
 }
 
 /*===========================================================================*/
 /* Module threads.                                                           */
 /*===========================================================================*/
 
-static THD_WORKING_AREA(wa_mic_selector_thd, 128);
-static THD_FUNCTION(thd_mic_selector, arg)
+static THD_WORKING_AREA(wa_dsp_thd, DSP_THD_STACK);
+static THD_FUNCTION(dsp_thd, arg)
 {
 	chRegSetThreadName(__FUNCTION__);
 	(void) arg;
 
-	systime_t time;
-
-	mic_start(&process_audio_data);
+	msg_t index;
+	chTMObjectInit(&dsp_time);
 
 	while(!chThdShouldTerminateX()){
+		//a reset of the mailbox wakes it up to stop
+		if(chMBFetch(&dsp_mailbox, &index, TIME_INFINITE) != MSG_OK)
+			continue;
+
+		chTMStartMeasurementX(&dsp_time);
+		mic_detection_process(mic_buffers[index], MIC_BLOCK_SIZE);
+		chTMStopMeasurementX(&dsp_time);
+
 		chSysLock();
+		mic_blocks_in_flight--;
+		chSysUnlock();
+	}
+
+	chThdExit(0);
+}
+
+static THD_WORKING_AREA(wa_mic_selector_thd, MIC_SELECTOR_THD_STACK);
+static THD_FUNCTION(thd_mic_selector, arg)
+{
+	chRegSetThreadName(__FUNCTION__);
+	(void) arg;
+
+	while(!chThdShouldTerminateX()){
 		if (selector_thd_paused){
-			chSchGoSleepS(CH_STATE_SUSPENDED);
+			chEvtWaitAny(SELECTOR_EVT_WAKE);
+			continue;
 		}
-		chSysUnlock();
 
 		disable_mic = (get_selector() % 8) <= 3;
 
-		time = chVTGetSystemTime();
-		chThdSleepUntilWindowed(time, time + MS2ST(MIC_SELECTOR_PERIOD));
+		//the selector has no interrupt, but a pause or a stop comes at once
+		chEvtWaitAnyTimeout(SELECTOR_EVT_WAKE, MS2ST(MIC_SELECTOR_PERIOD));
 	}
 
 	selector_thd_active = false;
@@ -225,6 +179,12 @@ static THD_FUNCTION(thd_mic_selector, arg)
 void create_mic_selector_thd(void)
 {
 	if(!selector_thd_active){
+		//on the caller's stack, the threads only get what their loops need
+		mic_detection_init(&action_queue_push);
+		mic_start(&process_audio_data);
+
+		ptr_dsp_thd = chThdCreateStatic(wa_dsp_thd,
+			sizeof(wa_dsp_thd), DSP_THD_PRIO, dsp_thd, NULL);
 		ptr_mic_selector_thd = chThdCreateStatic(wa_mic_selector_thd,
 			sizeof(wa_mic_selector_thd), NORMALPRIO, thd_mic_selector, NULL);
 		selector_thd_active = true;
@@ -234,9 +194,15 @@ void create_mic_selector_thd(void)
 void stop_mic_selector_thd(void)
 {
 	if (selector_thd_active){
-		resume_mic_selector_thd();
 		chThdTerminate(ptr_mic_selector_thd);
+		chEvtSignal(ptr_mic_selector_thd, SELECTOR_EVT_WAKE);
 		chThdWait(ptr_mic_selector_thd);
+		disable_mic = true;
+		chThdTerminate(ptr_dsp_thd);
+		//drops the blocks not processed yet and wakes dsp_thd
+		chMBReset(&dsp_mailbox);
+		chThdWait(ptr_dsp_thd);
+		mic_blocks_in_flight = 0;
 		selector_thd_active = false;
 		selector_thd_paused = false;
 	}
@@ -246,15 +212,25 @@ void pause_mic_selector_thd(void)
 {
 	if(selector_thd_active){
 		selector_thd_paused = true;
+		chEvtSignal(ptr_mic_selector_thd, SELECTOR_EVT_WAKE);
 	}
 }
 
 void resume_mic_selector_thd(void)
 {
-	chSysLock();
 	if(selector_thd_active && selector_thd_paused){
-		chSchWakeupS(ptr_mic_selector_thd, CH_STATE_READY);
 		selector_thd_paused = false;
+		chEvtSignal(ptr_mic_selector_thd, SELECTOR_EVT_WAKE);
 	}
+}
+
+void get_mic_stats(mic_stats_t *stats)
+{
+	chSysLock();
+	stats->dropped_blocks = mic_dropped_blocks;
+	stats->nb_blocks = dsp_time.n;
+	stats->last_us = dsp_time.last / CYCLES_PER_US;
+	stats->worst_us = dsp_time.worst / CYCLES_PER_US;
+	stats->average_us = dsp_time.n ? dsp_time.cumulative / dsp_time.n / CYCLES_PER_US : 0;
 	chSysUnlock();
 }
@@ -1,10 +1,22 @@
 #ifndef _MOD_AUDIO_PROCESSING_H_
 #define _MOD_AUDIO_PROCESSING_H_
 
+#include <stdint.h>
+
 void create_mic_selector_thd(void);
 
 void stop_mic_selector_thd(void);
 void pause_mic_selector_thd(void);
 void resume_mic_selector_thd(void);
 
+typedef struct {
+	uint32_t dropped_blocks;	// the DSP thread was too late for them
+	uint32_t nb_blocks;			// processed by the DSP thread
+	uint32_t last_us;			// processing time of a block
+	uint32_t worst_us;
+	uint32_t average_us;
+} mic_stats_t;
+
+void get_mic_stats(mic_stats_t *stats);
+
 #endif /* _MOD_AUDIO_PROCESSING_H_ */
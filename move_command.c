@@ -6,6 +6,7 @@
 
 //C standard headers
 #include <math.h>
+#include <stdlib.h>
 
 //ChibiOS headers
 #include "hal.h"
@@ -19,14 +20,14 @@
 //Module headers
 #include "ir_sensors.h"
 #include "move_command.h"
+#include "pid.h"
+#include "thread_profiler.h"
 
 /*===========================================================================*/
 /* Module constants.                                                         */
 /*===========================================================================*/
 //Geometric constants
 #define PI                  3.1415926536f
-#define WHEEL_SEPARATION    5.35f // [cm]
-#define WHEEL_PERIMETER     13    // [cm]
 #define EPUCK_PERIMETER     (PI*WHEEL_SEPARATION)
 //Adjusted manoeuvre based on experiments
 #define ADJUSTED_U_TURN     (EPUCK_PERIMETER/2)*0.98075
@@ -34,19 +35,33 @@
 //Speed constants
 #define NULL_SPEED          0
 #define MAX_SPEED           800
-//Steppers constants
-#define WHEEL_TURN_STEPS    1000 //Number of steps for one turn
+//Speed profile, trapezoidal
+#define MIN_SPEED           150     // [steps/s] started and stopped at without ramp
+#define ACCELERATION        2000    // [steps/s^2]
+#define MOVE_CRUISE_SPEED   MAX_SPEED
+#define TURN_CRUISE_SPEED   DEFAULT_SPEED
+//Wheel synchronisation, on the step difference
+#define SYNC_KP             5.0f    // [steps/s per step]
+#define SYNC_KI             10.0f   // [1/s]
+#define SYNC_KD             0.0f
+#define SYNC_MAX_CORRECTION 50      // [steps/s]
 //Wall collision
 #define WALL_THLD           1500
 //Thread constants
-#define MOTOR_THD_PERIOD    50
+#define MOTOR_THD_PERIOD    10
+#define MOTOR_EVT_COMMAND   EVENT_MASK(0)
+#define MOTOR_EVT_WHEEL_STOP EVENT_MASK(1)  // a wheel stop timer expired
+#define STOP_HORIZON        (2 * MOTOR_THD_PERIOD) // [ms] a wheel stop is armed within
 
 /*===========================================================================*/
 /* Module local variables.                                                   */
 /*===========================================================================*/
 
 static bool is_moving = false;
+//past the target of a move_through or an arc, until the next command
+static bool is_rolling = false;
 static bool rotation_mode = false;
+static thread_t *motor_thd_ptr = NULL;
 static bool motor_thd_paused = false;
 static bool collision_enabled = false;
 
@@ -54,10 +69,44 @@ static int32_t l_target_pos = 0;
 static int32_t r_target_pos = 0;
 static int32_t l_pos = 0;
 static int32_t r_pos = 0;
+//Step counters at the start of the command, they are never reset
+static int32_t l_start_pos = 0;
+static int32_t r_start_pos = 0;
+
+//Speed profile of the running move or turn
+static int16_t profile_speed = 0;       // also the last speed given in a corridor
+static int16_t cruise_speed = 0;
+static int16_t exit_speed = 0;          // kept at the target, 0 to stop there
+//Speed of each wheel relative to the profile, the inner one is slower on arcs.
+//They ramp to their targets, so that no wheel changes speed at once.
+static float l_speed_ratio = 1.0f;
+static float r_speed_ratio = 1.0f;
+static float l_ratio_target = 1.0f;
+static float r_ratio_target = 1.0f;
+//Keeps the wheels at their ratio, added to the left wheel and taken from the
+//right one after their ratios, so that the inner wheel gets all of it
+static pid_controller_t sync_pid;
+static float sync_correction = 0.0f;
+//[steps] where the inner wheel should be, from the progress of the outer one
+static float sync_reference = 0.0f;
+static int32_t sync_outer_pos = 0;
 
 static direction_t current_direction = FORWARD;
 static rotation_t current_rotation = COUNTERCLOCKWISE;
 
+//One-shot stop of a wheel right on its target, between two ticks of motor_thd.
+//The timer only wakes motor_thd, which owns the motors and stops the wheel.
+typedef struct {
+	virtual_timer_t vt;
+	void (*set_speed)(int speed);
+	bool armed;
+	volatile bool expired;
+	bool stopped;
+} wheel_stop_t;
+
+static wheel_stop_t l_stop = {.set_speed = left_motor_set_speed};
+static wheel_stop_t r_stop = {.set_speed = right_motor_set_speed};
+
 /*===========================================================================*/
 /* Semaphores.                                                               */
 /*===========================================================================*/
@@ -69,7 +118,7 @@ static BSEMAPHORE_DECL(move_command_finished, TRUE);
 /*===========================================================================*/
 
 bool wall_ahead(void) {
-	//Front
+	//Front, raw values so that the filter delay never postpones a stop
 	if((get_ir_delta(IR1) > WALL_THLD) && collision_enabled) return true;
 	if((get_ir_delta(IR8) > WALL_THLD) && collision_enabled) return true;
 	return false;
@@ -77,16 +126,20 @@ bool wall_ahead(void) {
 
 void update_current_position(void) {
 	if (rotation_mode) {
-		l_pos = current_rotation * left_motor_get_pos();
-		r_pos = current_rotation * right_motor_get_pos();
+		l_pos = current_rotation * (left_motor_get_pos() - l_start_pos);
+		r_pos = current_rotation * (right_motor_get_pos() - r_start_pos);
 	}
 	else {
-		l_pos = current_direction * left_motor_get_pos();
-		r_pos = current_direction * right_motor_get_pos();
+		l_pos = current_direction * (left_motor_get_pos() - l_start_pos);
+		r_pos = current_direction * (right_motor_get_pos() - r_start_pos);
 	}
 }
 
 bool position_reached(void) {
+	//an arc is done once the robot turned by a quarter turn, the ramps into
+	//and out of it make the wheels go a little further than their targets
+	if (l_ratio_target < 1.0f) return r_pos - l_pos >= r_target_pos - l_target_pos;
+	if (r_ratio_target < 1.0f) return l_pos - r_pos >= l_target_pos - r_target_pos;
 	if (l_pos>l_target_pos && r_pos>r_target_pos && !rotation_mode)
 		return true;
 	if (l_pos>l_target_pos && r_pos<r_target_pos && rotation_mode)
@@ -94,16 +147,195 @@ bool position_reached(void) {
 	return false;
 }
 
+// highest speed from which `end_speed` can still be reached within `steps`
+int16_t braking_speed(float steps, int16_t end_speed) {
+	if (steps <= 0)
+		return end_speed;
+
+	float speed = sqrtf(end_speed * end_speed + 2.0f * ACCELERATION * steps);
+	return speed > MAX_SPEED ? MAX_SPEED : (int16_t)speed;
+}
+
+static bool speed_ratios_ramping(void) {
+	return l_speed_ratio != l_ratio_target || r_speed_ratio != r_ratio_target;
+}
+
+// one step of the ratios towards their targets, as fast as ACCELERATION allows
+static void ramp_speed_ratios(float dt) {
+	float step = ACCELERATION * dt / (profile_speed > MIN_SPEED ? profile_speed : MIN_SPEED);
+
+	if (fabsf(l_ratio_target - l_speed_ratio) <= step) l_speed_ratio = l_ratio_target;
+	else l_speed_ratio += l_ratio_target > l_speed_ratio ? step : -step;
+	if (fabsf(r_ratio_target - r_speed_ratio) <= step) r_speed_ratio = r_ratio_target;
+	else r_speed_ratio += r_ratio_target > r_speed_ratio ? step : -step;
+}
+
+// for turns in place and manual speeds, which have no ramp of their own
+static void reset_speed_ratios(void) {
+	l_speed_ratio = 1.0f;
+	r_speed_ratio = 1.0f;
+	l_ratio_target = 1.0f;
+	r_ratio_target = 1.0f;
+}
+
+static int16_t l_wheel_speed(void) {
+	return roundf(profile_speed * l_speed_ratio + sync_correction);
+}
+
+static int16_t r_wheel_speed(void) {
+	return roundf(profile_speed * r_speed_ratio - sync_correction);
+}
+
+void set_profile_speed(void) {
+	int16_t l_speed = l_wheel_speed();
+	int16_t r_speed = r_wheel_speed();
+
+	if (rotation_mode) {
+		left_motor_set_speed(current_rotation * l_speed);
+		right_motor_set_speed(-(current_rotation * r_speed));
+	}
+	else {
+		left_motor_set_speed(current_direction * l_speed);
+		right_motor_set_speed(current_direction * r_speed);
+	}
+}
+
+// follows the speed profile for the rest of the move or turn
+void update_profile_speed(void) {
+	//the profile is the one of the outer wheel, the left one on straight
+	//lines, the right one goes backward in turns
+	bool left_outer = l_ratio_target >= r_ratio_target;
+	int32_t r_progress = rotation_mode ? -r_pos : r_pos;
+	int32_t outer_pos = left_outer ? l_pos : r_progress;
+	int32_t inner_pos = left_outer ? r_progress : l_pos;
+	int32_t remaining = left_outer ? l_target_pos - l_pos : r_target_pos - r_pos;
+	int16_t target = braking_speed(remaining, exit_speed > MIN_SPEED ? exit_speed : MIN_SPEED);
+	if (target > cruise_speed)
+		target = cruise_speed;
+
+	profile_speed = get_ramped_speed(profile_speed, target, MOTOR_THD_PERIOD / 1000.0f);
+
+	//the inner wheel should follow the outer one at the ratio of the moment,
+	//which changes along the ramps
+	sync_reference += (outer_pos - sync_outer_pos) * (left_outer ? r_speed_ratio / l_speed_ratio
+	                                                              : l_speed_ratio / r_speed_ratio);
+	sync_outer_pos = outer_pos;
+	//what the integral learns at one ratio is wrong at the next, it is held
+	//at its reset by start_profile until the ratios settle
+	pid_freeze_integral(&sync_pid, speed_ratios_ramping());
+	ramp_speed_ratios(MOTOR_THD_PERIOD / 1000.0f);
+
+	//positive when the left wheel is ahead of its share
+	float sync_error = left_outer ? sync_reference - inner_pos : inner_pos - sync_reference;
+	sync_correction = pid_update(&sync_pid, 0.0f, sync_error, MOTOR_THD_PERIOD / 1000.0f);
+
+	set_profile_speed();
+}
+
+static void wheel_stop_cb(void *arg) {
+	wheel_stop_t *stop = arg;
+
+	chSysLockFromISR();
+	stop->expired = true;
+	chEvtSignalI(motor_thd_ptr, MOTOR_EVT_WHEEL_STOP);
+	chSysUnlockFromISR();
+}
+
+/**
+ * @brief           Arms a timer to stop the wheel when it reaches its target,
+ *                  if that comes before the next ticks of motor_thd.
+ * @param remaining [steps] to the target
+ * @param speed     [steps/s] held until the target
+ */
+static void arm_wheel_stop(wheel_stop_t *stop, int32_t remaining, int16_t speed) {
+	if (stop->armed)
+		return;
+
+	if (remaining <= 0) {
+		stop->set_speed(NULL_SPEED);
+		stop->stopped = true;
+		stop->armed = true;
+	}
+	else if (speed > 0 && remaining * 1000 <= speed * STOP_HORIZON) {
+		stop->armed = true;
+		chVTSet(&stop->vt, US2ST((uint32_t)remaining * 1000000 / speed),
+		        wheel_stop_cb, stop);
+	}
+}
+
+// stops the wheel once its timer expired, from motor_thd
+static void apply_wheel_stop(wheel_stop_t *stop) {
+	if (stop->expired && !stop->stopped) {
+		stop->set_speed(NULL_SPEED);
+		stop->stopped = true;
+	}
+}
+
+static void reset_wheel_stop(wheel_stop_t *stop) {
+	chVTReset(&stop->vt);
+	stop->armed = false;
+	stop->expired = false;
+	stop->stopped = false;
+}
+
+// starts a move, turn or arc from the current speed
+void start_profile(int16_t cruise, int16_t exit) {
+	reset_wheel_stop(&l_stop);
+	reset_wheel_stop(&r_stop);
+	pid_reset(&sync_pid);
+	sync_correction = 0.0f;
+	sync_reference = 0.0f;
+	sync_outer_pos = 0;
+	if (profile_speed < MIN_SPEED)
+		profile_speed = MIN_SPEED;
+	cruise_speed = cruise;
+	exit_speed = exit;
+	is_rolling = false;
+	is_moving = true;
+	set_profile_speed();
+	chEvtSignal(motor_thd_ptr, MOTOR_EVT_COMMAND);
+}
+
 void stop_moving(void) {
+	bool was_moving = is_moving;
+
+	reset_wheel_stop(&l_stop);
+	reset_wheel_stop(&r_stop);
 	left_motor_set_speed(NULL_SPEED);
 	right_motor_set_speed(NULL_SPEED);
+	profile_speed = NULL_SPEED;
+	reset_speed_ratios();
 	current_direction = FORWARD;
 	current_rotation = COUNTERCLOCKWISE;
 	rotation_mode = false;
 	l_target_pos = 0;
 	r_target_pos = 0;
+	is_rolling = false;
 	is_moving = false;
 	collision_enabled = false;
+	//past the target, the command was already signaled as finished
+	if (was_moving)
+		chBSemSignal(&move_command_finished);
+}
+
+// at the target of a move or an arc, goes on straight at the exit speed,
+// motor_thd ramps the speed and the wheels to it and stops at a wall
+void finish_moving(void) {
+	if (!exit_speed || rotation_mode) {
+		stop_moving();
+		return;
+	}
+
+	l_ratio_target = 1.0f;
+	r_ratio_target = 1.0f;
+	pid_reset(&sync_pid);
+	sync_correction = 0.0f;
+	set_profile_speed();
+	l_target_pos = 0;
+	r_target_pos = 0;
+	is_rolling = true;
+	collision_enabled = true;
+	is_moving = false;
 	chBSemSignal(&move_command_finished);
 }
 
@@ -116,20 +348,64 @@ static THD_FUNCTION(motor_thd, arg) {
 	chRegSetThreadName(__FUNCTION__);
 	(void) arg;
 
-	systime_t time;
+	systime_t deadline = chVTGetSystemTime();
 
 	while (true) {
+		//nothing to follow until the next move, turn or pause
+		if (!is_moving && !is_rolling && !motor_thd_paused && !speed_ratios_ramping()) {
+			profiler_wait_begin();
+			chEvtWaitAny(MOTOR_EVT_COMMAND);
+			profiler_wait_end();
+			deadline = chVTGetSystemTime();
+		}
+
 		if (wall_ahead()) stop_moving();
 		else {
 			if (motor_thd_paused) {
 				left_motor_set_speed(NULL_SPEED);
 				right_motor_set_speed(NULL_SPEED);
+				//starts again from the bottom of the ramp
+				profile_speed = NULL_SPEED;
 			}
 			update_current_position();
-			if (position_reached()) stop_moving();
+			//only moves and turns have a target, not the corridors
+			if (is_moving && exit_speed && !rotation_mode) {
+				//goes on past the target, a few steps late do not matter
+				if (position_reached()) finish_moving();
+				else if (!motor_thd_paused) update_profile_speed();
+			}
+			else if (is_moving) {
+				apply_wheel_stop(&l_stop);
+				apply_wheel_stop(&r_stop);
+				if (l_stop.stopped && r_stop.stopped) stop_moving();
+				else if (!motor_thd_paused) {
+					//the speeds are held once a stop is armed, so that it stays on time
+					if (!l_stop.armed && !r_stop.armed) update_profile_speed();
+					arm_wheel_stop(&l_stop, l_target_pos - l_pos, l_wheel_speed());
+					arm_wheel_stop(&r_stop, rotation_mode ? r_pos - r_target_pos
+					                                      : r_target_pos - r_pos,
+					               r_wheel_speed());
+				}
+			}
+			else if (!motor_thd_paused && (is_rolling || speed_ratios_ramping())) {
+				//out of an arc or past a move, until the next command takes over
+				if (is_rolling)
+					profile_speed = get_ramped_speed(profile_speed, exit_speed,
+					                                 MOTOR_THD_PERIOD / 1000.0f);
+				ramp_speed_ratios(MOTOR_THD_PERIOD / 1000.0f);
+				set_profile_speed();
+			}
+		}
+		//each wheel stop ends the wait, so the wheel stops right on target
+		if ((l_stop.armed || r_stop.armed) && !(l_stop.stopped && r_stop.stopped)) {
+			profiler_wait_begin();
+			chEvtWaitAnyTimeout(MOTOR_EVT_WHEEL_STOP, MS2ST(MOTOR_THD_PERIOD));
+			profiler_wait_end();
+			deadline = chVTGetSystemTime();
+		}
+		else {
+			deadline = profiler_sleep_until_windowed(deadline, deadline + MS2ST(MOTOR_THD_PERIOD));
 		}
-		time = chVTGetSystemTime();
-		chThdSleepUntilWindowed(time, time + MS2ST(MOTOR_THD_PERIOD));
 	}
 
 	chThdExit(0);
@@ -141,12 +417,17 @@ static THD_FUNCTION(motor_thd, arg) {
 
 void init_motors_thd(void) {
 	motors_init();
-	chThdCreateStatic(wa_motor_thd, sizeof(wa_motor_thd), NORMALPRIO + 1,
-					  motor_thd, NULL);
+	chVTObjectInit(&l_stop.vt);
+	chVTObjectInit(&r_stop.vt);
+	pid_init(&sync_pid, SYNC_KP, SYNC_KI, SYNC_KD,
+	         -SYNC_MAX_CORRECTION, SYNC_MAX_CORRECTION);
+	motor_thd_ptr = chThdCreateStatic(wa_motor_thd, sizeof(wa_motor_thd),
+					  NORMALPRIO + 1, motor_thd, NULL);
 }
 
 void pause_motor_thd(void) {
 	motor_thd_paused = true;
+	chEvtSignal(motor_thd_ptr, MOTOR_EVT_COMMAND);
 }
 
 void resume_motor_thd(void) {
@@ -165,15 +446,16 @@ void turn(float position, rotation_t direction) {
 	motor_thd_paused = false;
 	collision_enabled = false;
 	if (!is_moving) {
-		left_motor_set_pos(0);
-		right_motor_set_pos(0);
+		l_start_pos = left_motor_get_pos();
+		r_start_pos = right_motor_get_pos();
 		l_target_pos = position * WHEEL_TURN_STEPS / WHEEL_PERIMETER;
-		r_target_pos = -(position * WHEEL_PERIMETER / WHEEL_PERIMETER);
+		r_target_pos = -(position * WHEEL_TURN_STEPS / WHEEL_PERIMETER);
 		current_rotation = direction;
 		rotation_mode = true;
-		is_moving = true;
-		left_motor_set_speed(direction * DEFAULT_SPEED);
-		right_motor_set_speed(-(direction * DEFAULT_SPEED));
+		reset_speed_ratios();
+		//turns in place always start from a stop
+		profile_speed = NULL_SPEED;
+		start_profile(TURN_CRUISE_SPEED, NULL_SPEED);
 	}
 }
 
@@ -181,19 +463,52 @@ void move(float position, direction_t direction) {
 	motor_thd_paused = false;
 	collision_enabled = false;
 	if (!is_moving) {
-		left_motor_set_pos(0);
-		right_motor_set_pos(0);
+		l_start_pos = left_motor_get_pos();
+		r_start_pos = right_motor_get_pos();
 		l_target_pos=position * WHEEL_TURN_STEPS / WHEEL_PERIMETER;
-		r_target_pos=position * WHEEL_PERIMETER / WHEEL_PERIMETER;
+		r_target_pos=position * WHEEL_TURN_STEPS / WHEEL_PERIMETER;
 		current_direction = direction;
 		rotation_mode = false;
-		is_moving = true;
-		left_motor_set_speed(direction*DEFAULT_SPEED);
-		right_motor_set_speed(direction*DEFAULT_SPEED);
+		//straightens out of an arc on the way
+		l_ratio_target = 1.0f;
+		r_ratio_target = 1.0f;
+		start_profile(MOVE_CRUISE_SPEED, NULL_SPEED);
+	}
+}
+
+void move_through(float position, direction_t direction, int16_t speed) {
+	move(position, direction);
+	exit_speed = speed;
+}
+
+float arc_turn(float radius, rotation_t direction) {
+	motor_thd_paused = false;
+	collision_enabled = false;
+	//the inner wheel would nearly stop on a tighter arc
+	if (radius < MIN_ARC_RADIUS)
+		radius = MIN_ARC_RADIUS;
+	if (!is_moving) {
+		float angle = ADJUSTED_90DEG_TURN / (WHEEL_SEPARATION / 2);
+		float outer = (radius + WHEEL_SEPARATION / 2) * angle;
+		float inner = (radius - WHEEL_SEPARATION / 2) * angle;
+
+		l_start_pos = left_motor_get_pos();
+		r_start_pos = right_motor_get_pos();
+		//clockwise turns right, around the right wheel
+		l_target_pos = (direction == CLOCKWISE ? outer : inner) * WHEEL_TURN_STEPS / WHEEL_PERIMETER;
+		r_target_pos = (direction == CLOCKWISE ? inner : outer) * WHEEL_TURN_STEPS / WHEEL_PERIMETER;
+		//ramped into from the current ratios
+		l_ratio_target = direction == CLOCKWISE ? 1.0f : inner / outer;
+		r_ratio_target = direction == CLOCKWISE ? inner / outer : 1.0f;
+		current_direction = FORWARD;
+		rotation_mode = false;
+		int16_t speed = profile_speed < TURN_CRUISE_SPEED ? profile_speed : TURN_CRUISE_SPEED;
+		start_profile(TURN_CRUISE_SPEED, speed);
 	}
+	return radius;
 }
 
-void right_angle_turn(direction_t direction) {
+void right_angle_turn(rotation_t direction) {
 	turn(ADJUSTED_90DEG_TURN, direction);
 }
 
@@ -202,7 +517,13 @@ void u_turn(void) {
 }
 
 void set_lr_speed(int left_speed, int right_speed) {
+	//first, so that motor_thd leaves the speeds to us
+	is_rolling = false;
+	collision_enabled = false;
 	if (is_moving) stop_moving();
+	reset_speed_ratios();
+	//a move started from here begins at this speed
+	profile_speed = (abs(left_speed) + abs(right_speed)) / 2;
 	if (left_speed > MAX_SPEED)
 		left_motor_set_speed(MAX_SPEED);
 	else if (left_speed < -MAX_SPEED)
@@ -218,6 +539,50 @@ void set_lr_speed(int left_speed, int right_speed) {
 		right_motor_set_speed(right_speed);
 }
 
+int16_t get_current_speed(void) {
+	return profile_speed;
+}
+
+int16_t get_braking_speed(float distance) {
+	return braking_speed(distance_to_steps(distance), MIN_SPEED);
+}
+
+int32_t get_travelled_steps(void) {
+	return (left_motor_get_pos() - l_start_pos + right_motor_get_pos() - r_start_pos) / 2;
+}
+
+int32_t distance_to_steps(float distance) {
+	return distance * WHEEL_TURN_STEPS / WHEEL_PERIMETER;
+}
+
+float steps_to_distance(int32_t steps) {
+	return (float)steps * WHEEL_PERIMETER / WHEEL_TURN_STEPS;
+}
+
+float get_braking_distance(void) {
+	if (profile_speed <= MIN_SPEED)
+		return 0.0f;
+	float steps = (profile_speed * profile_speed - MIN_SPEED * MIN_SPEED) / (2.0f * ACCELERATION);
+	return steps_to_distance(steps);
+}
+
+int16_t get_ramped_speed(int16_t speed, int16_t target, float dt) {
+	int16_t step = ACCELERATION * dt;
+
+	if (speed < MIN_SPEED)
+		speed = MIN_SPEED;
+
+	if (target > speed)
+		return speed + step < target ? speed + step : target;
+
+	//the braking curves decelerate at ACCELERATION, so they are followed,
+	//but a target that drops at once is ramped down to, and below
+	//MIN_SPEED the motors stop without ramp
+	int16_t lowest = target > MIN_SPEED ? target : MIN_SPEED;
+	int16_t ramped = speed - step;
+	return ramped > lowest ? ramped : target;
+}
+
 binary_semaphore_t *get_motor_semaphore_ptr(void) {
 	return &move_command_finished;
 }
@@ -5,6 +5,13 @@
 
 #define DEFAULT_SPEED   500
 
+//Geometric constants
+#define WHEEL_SEPARATION    5.35f   // [cm]
+#define WHEEL_PERIMETER     13      // [cm]
+#define WHEEL_TURN_STEPS    1000    // Number of steps for one turn
+//Arcs, the inner wheel keeps a fifth of the outer wheel's speed at this radius
+#define MIN_ARC_RADIUS      4.0f    // [cm]
+
 /*===========================================================================*/
 /*  Module data structures and types                                         */
 /*===========================================================================*/
@@ -34,15 +41,72 @@ bool get_is_moving(void);
 void turn(float position, rotation_t direction);
 void move(float position, direction_t direction);
 
-void right_angle_turn(direction_t direction);
+/**
+ * @brief           Same as move, but the robot goes on straight once there
+ *                  instead of stopping, ramping to `speed` [steps/s], until
+ *                  the next command or a wall in front. The motor semaphore
+ *                  is still signaled at the target, and not at the wall.
+ */
+void move_through(float position, direction_t direction, int16_t speed);
+
+/**
+ * @brief           Quarter turn along an arc of `radius` [cm], measured at
+ *                  the middle of the wheels, without stopping before or after.
+ *                  The wheels ramp into the arc and out of it, and the robot
+ *                  goes on straight at the speed it started with.
+ * @return          The radius of the arc, at least MIN_ARC_RADIUS so that
+ *                  the inner wheel doesn't nearly stop.
+ */
+float arc_turn(float radius, rotation_t direction);
+
+void right_angle_turn(rotation_t direction);
 void u_turn(void);
 
 void set_default_speed(void);
 void set_current_speed(int16_t new_speed);
+
+/**
+ * @brief           Speed of the running move, turn or arc, or the last one
+ *                  given in a corridor, in steps/s.
+ */
 int16_t get_current_speed(void);
 
 void set_lr_speed(int left_speed, int right_speed);
 
+/**
+ * @brief           Stops the motors, and signals the motor semaphore if a
+ *                  move, turn or arc was running.
+ */
+void stop_moving(void);
+
+/**
+ * @brief           Highest speed from which the robot can still slow down
+ *                  to a stop within `distance` [cm].
+ */
+int16_t get_braking_speed(float distance);
+
+/**
+ * @brief           Next speed towards `target`, `dt` [s] later, without
+ *                  accelerating or decelerating faster than the motors can
+ *                  follow. Below the start speed, the target is given as is.
+ */
+int16_t get_ramped_speed(int16_t speed, int16_t target, float dt);
+
+int32_t distance_to_steps(float distance);
+float steps_to_distance(int32_t steps);
+
+/**
+ * @brief           Distance [cm] the robot needs to slow down to a stop from
+ *                  its current speed.
+ */
+float get_braking_distance(void);
+
+/**
+ * @brief           Average of the two wheels since the start of the last
+ *                  move, turn or arc, in steps.
+ */
+int32_t get_travelled_steps(void);
+
 void end_manual_speed(void);
 
 binary_semaphore_t *get_motor_semaphore_ptr(void);
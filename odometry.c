@@ -0,0 +1,276 @@
+/**
+ * @file    odometry.c
+ * @brief   Pose estimator
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+// ChibiOS headers
+#include "ch.h"
+#include "hal.h"
+
+// e-puck 2 main processor headers
+#include "motors.h"
+
+// Module headers
+#include "odometry.h"
+#include "distance.h"
+#include "ir_sensors.h"
+#include "move_command.h"
+#include "thread_profiler.h"
+
+/*===========================================================================*/
+/* Module constants.                                                         */
+/*===========================================================================*/
+
+#define PI                      3.1415926536f
+#define HALF_PI                 (PI / 2)
+#define CM_PER_STEP             ((float)WHEEL_PERIMETER / WHEEL_TURN_STEPS)
+//Wheels
+#define STEP_NOISE              0.01f   // [cm^2] variance of each wheel per cm
+//Side walls, heading observation
+#define SIDE_WALL_THLD          300     // IR3 & IR6 both above, between two walls
+#define PARALLEL_THLD           20      // IR3 - IR6 changing less per sample
+#define HEADING_VARIANCE        0.0025f // [rad^2], about 3 degrees
+//Front wall, along-track observation
+#define FRONT_WALL_RANGE        150     // [mm] ToF below, the wall is in sight
+#define FRONT_WALL_VARIANCE     0.25f   // [cm^2]
+#define FRONT_WALL_MAX_ANGLE    0.2f    // [rad] from the heading it was seen at
+//Thread constants
+#define ODOMETRY_PERIOD         5       // [ms]
+
+enum { X, Y, THETA, NB_STATES };
+
+/*===========================================================================*/
+/* Module local variables.                                                   */
+/*===========================================================================*/
+
+//Only used by odometry_thd
+static float state[NB_STATES];
+static float cov[NB_STATES][NB_STATES];
+
+//Front wall landmark, along the heading it was first seen at
+static bool wall_in_sight = false;
+static float wall_heading = 0.0f;
+static float wall_position = 0.0f;      // [cm] along wall_heading
+
+//Copy for the other threads
+static pose_estimate_t published;
+
+/*===========================================================================*/
+/* Module local functions.                                                   */
+/*===========================================================================*/
+
+static float wrap_angle(float angle)
+{
+	while(angle > PI)
+		angle -= 2 * PI;
+	while(angle < -PI)
+		angle += 2 * PI;
+	return angle;
+}
+
+/**
+ * @brief           Integrates the travel of both wheels.
+ * @param dl        [cm] travelled by the left wheel
+ * @param dr        [cm] travelled by the right wheel
+ */
+static void predict(float dl, float dr)
+{
+	float ds = (dl + dr) / 2;
+	float dtheta = (dr - dl) / WHEEL_SEPARATION;
+	float mid = state[THETA] + dtheta / 2;
+	float c = cosf(mid);
+	float s = sinf(mid);
+
+	state[X] += ds * c;
+	state[Y] += ds * s;
+	state[THETA] = wrap_angle(state[THETA] + dtheta);
+
+	//jacobians of the motion to the state, and to the wheel travels
+	const float f[NB_STATES][NB_STATES] = {
+		{1, 0, -ds * s},
+		{0, 1,  ds * c},
+		{0, 0,  1},
+	};
+	const float g[NB_STATES][2] = {
+		{c / 2 + ds * s / (2 * WHEEL_SEPARATION), c / 2 - ds * s / (2 * WHEEL_SEPARATION)},
+		{s / 2 - ds * c / (2 * WHEEL_SEPARATION), s / 2 + ds * c / (2 * WHEEL_SEPARATION)},
+		{-1 / WHEEL_SEPARATION, 1 / WHEEL_SEPARATION},
+	};
+	const float q[2] = {STEP_NOISE * fabsf(dl), STEP_NOISE * fabsf(dr)};
+
+	//cov = f cov f' + g q g'
+	float fp[NB_STATES][NB_STATES];
+	for(int i = 0 ; i < NB_STATES ; i++){
+		for(int j = 0 ; j < NB_STATES ; j++){
+			fp[i][j] = 0;
+			for(int k = 0 ; k < NB_STATES ; k++)
+				fp[i][j] += f[i][k] * cov[k][j];
+		}
+	}
+	for(int i = 0 ; i < NB_STATES ; i++){
+		for(int j = 0 ; j < NB_STATES ; j++){
+			float sum = g[i][0] * q[0] * g[j][0] + g[i][1] * q[1] * g[j][1];
+			for(int k = 0 ; k < NB_STATES ; k++)
+				sum += fp[i][k] * f[j][k];
+			cov[i][j] = sum;
+		}
+	}
+}
+
+/**
+ * @brief           Corrects the state with a scalar observation.
+ * @param h         Jacobian of the observation to the state
+ * @param innovation Observed minus predicted
+ * @param variance  Of the observation
+ */
+static void correct(const float h[NB_STATES], float innovation, float variance)
+{
+	float ph[NB_STATES];
+	float s = variance;
+	for(int i = 0 ; i < NB_STATES ; i++){
+		ph[i] = 0;
+		for(int j = 0 ; j < NB_STATES ; j++)
+			ph[i] += cov[i][j] * h[j];
+		s += h[i] * ph[i];
+	}
+
+	for(int i = 0 ; i < NB_STATES ; i++)
+		state[i] += ph[i] / s * innovation;
+	state[THETA] = wrap_angle(state[THETA]);
+
+	//cov = cov - k h cov, with k = ph / s
+	for(int i = 0 ; i < NB_STATES ; i++){
+		for(int j = 0 ; j < NB_STATES ; j++)
+			cov[i][j] -= ph[i] * ph[j] / s;
+	}
+}
+
+/**
+ * @brief           Between two parallel side walls, the heading is the one
+ *                  of the corridor, a multiple of 90 degrees.
+ */
+static void observe_side_walls(const ir_snapshot_t *ir, int32_t *last_balance)
+{
+	int32_t balance = ir->filtered[IR3] - ir->filtered[IR6];
+	bool parallel = abs(balance - *last_balance) < PARALLEL_THLD;
+	*last_balance = balance;
+
+	if(ir->filtered[IR3] < SIDE_WALL_THLD || ir->filtered[IR6] < SIDE_WALL_THLD || !parallel)
+		return;
+
+	static const float h[NB_STATES] = {0, 0, 1};
+	float corridor = roundf(state[THETA] / HALF_PI) * HALF_PI;
+	correct(h, wrap_angle(corridor - state[THETA]), HEADING_VARIANCE);
+}
+
+/**
+ * @brief           The front wall stays where it was first seen, so the ToF
+ *                  tells how far the robot went towards it.
+ */
+static void observe_front_wall(const dist_measure_t *m)
+{
+	if(m->distance >= FRONT_WALL_RANGE){
+		wall_in_sight = false;
+		return;
+	}
+
+	float distance = m->distance / 10.0f;
+	float c = cosf(wall_heading);
+	float s = sinf(wall_heading);
+
+	//a new wall, or the same one seen from another corridor after a turn
+	if(!wall_in_sight || fabsf(wrap_angle(state[THETA] - wall_heading)) > FRONT_WALL_MAX_ANGLE){
+		wall_heading = state[THETA];
+		wall_position = state[X] * cosf(wall_heading) + state[Y] * sinf(wall_heading) + distance;
+		wall_in_sight = true;
+		return;
+	}
+
+	const float h[NB_STATES] = {-c, -s, 0};
+	float predicted = wall_position - (state[X] * c + state[Y] * s);
+	correct(h, distance - predicted, FRONT_WALL_VARIANCE);
+}
+
+static void publish(void)
+{
+	chSysLock();
+	published.timestamp = chVTGetSystemTimeX();
+	published.pose.x = state[X];
+	published.pose.y = state[Y];
+	published.pose.theta = state[THETA];
+	for(int i = 0 ; i < NB_STATES ; i++){
+		for(int j = 0 ; j < NB_STATES ; j++)
+			published.cov[i][j] = cov[i][j];
+	}
+	chSysUnlock();
+}
+
+/*===========================================================================*/
+/* Module threads.                                                           */
+/*===========================================================================*/
+
+static THD_WORKING_AREA(wa_odometry_thd, 1024);
+static THD_FUNCTION(odometry_thd, arg)
+{
+	chRegSetThreadName(__FUNCTION__);
+	(void)arg;
+
+	int32_t last_left = left_motor_get_pos();
+	int32_t last_right = right_motor_get_pos();
+	ir_snapshot_t ir;
+	get_ir_snapshot(&ir);
+	uint32_t ir_seq = ir.seq;
+	int32_t last_balance = 0;
+	dist_measure_t tof;
+	dist_get_measure(&tof);
+	uint32_t tof_seq = tof.seq;
+
+	systime_t deadline = chVTGetSystemTime();
+
+	while(!chThdShouldTerminateX()){
+		int32_t left = left_motor_get_pos();
+		int32_t right = right_motor_get_pos();
+		predict((left - last_left) * CM_PER_STEP, (right - last_right) * CM_PER_STEP);
+		last_left = left;
+		last_right = right;
+
+		get_ir_snapshot(&ir);
+		if(ir.seq != ir_seq){
+			observe_side_walls(&ir, &last_balance);
+			ir_seq = ir.seq;
+		}
+
+		dist_get_measure(&tof);
+		if(tof.seq != tof_seq){
+			observe_front_wall(&tof);
+			tof_seq = tof.seq;
+		}
+
+		publish();
+		deadline = profiler_sleep_until_windowed(deadline, deadline + MS2ST(ODOMETRY_PERIOD));
+	}
+
+	chThdExit(0);
+}
+
+/*===========================================================================*/
+/* Module exported functions.                                                */
+/*===========================================================================*/
+
+void odometry_start(void)
+{
+	publish();
+	chThdCreateStatic(wa_odometry_thd, sizeof(wa_odometry_thd),
+	                  NORMALPRIO, odometry_thd, NULL);
+}
+
+void odometry_get_pose(pose_estimate_t *estimate)
+{
+	chSysLock();
+	*estimate = published;
+	chSysUnlock();
+}
@@ -0,0 +1,50 @@
+/**
+ * @file    odometry.h
+ * @brief   Pose of the robot, integrated from the wheel steps and corrected
+ *          by the walls.
+ *
+ * An extended Kalman filter integrates the steps of both wheels every
+ * ODOMETRY_PERIOD. The corridors of the maze meet at right angles, so between
+ * two parallel side walls the heading is a multiple of 90 degrees, and a front
+ * wall seen by the ToF is a landmark for the distance travelled towards it.
+ * The frame is the one of the robot when odometry_start is called: x forward,
+ * y to the left, theta counterclockwise.
+ */
+
+#ifndef _ODOMETRY_H_
+#define _ODOMETRY_H_
+
+#include <ch.h>
+
+/*===========================================================================*/
+/*  Module data structures and types                                         */
+/*===========================================================================*/
+
+typedef struct {
+	float x;                    // [cm]
+	float y;                    // [cm]
+	float theta;                // [rad] within [-pi, pi]
+} pose_t;
+
+typedef struct {
+	systime_t timestamp;        // of the last update
+	pose_t pose;
+	float cov[3][3];            // of x, y, theta, in that order
+} pose_estimate_t;
+
+/*===========================================================================*/
+/*  External declarations                                                    */
+/*===========================================================================*/
+
+/**
+ * @brief           Starts the estimator at the origin. Call it after the
+ *                  motors, the ToF and the IR sensors are started.
+ */
+void odometry_start(void);
+
+/**
+ * @brief           Copies the last estimate, from any thread.
+ */
+void odometry_get_pose(pose_estimate_t *estimate);
+
+#endif /* _ODOMETRY_H_ */
@@ -0,0 +1,239 @@
+/**
+ * @file    path_journal.c
+ * @brief   Append-only flash journal of the saved path
+ *
+ * Each sector starts with a 32-bit sequence number, followed by one byte per
+ * record: an action, or JOURNAL_RESET. Erased flash reads as 0xFF, which marks
+ * the end of the journal. The active sector is the one with the highest valid
+ * sequence number. The header of a new sector is only written once the path has
+ * been copied in, so a power loss during a rewrite keeps the old sector.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// ChibiOS headers
+#include "ch.h"
+#include "hal.h"
+
+// Module headers
+#include "action_queue.h"
+#include "path_journal.h"
+
+/*===========================================================================*/
+/* Module constants.                                                         */
+/*===========================================================================*/
+
+#define JOURNAL_SECTOR_SIZE     0x20000 // 128 KiB
+#define JOURNAL_HEADER_SIZE     sizeof(uint32_t)
+#define JOURNAL_NB_SECTORS      2
+
+#define JOURNAL_RESET           0x00
+#define JOURNAL_ERASED_BYTE     0xFF
+#define JOURNAL_ERASED_WORD     0xFFFFFFFF
+#define JOURNAL_OBSOLETE        0x00000000
+
+#define FLASH_KEY1              0x45670123
+#define FLASH_KEY2              0xCDEF89AB
+#define FLASH_CR_SNB_SHIFT      3
+#define FLASH_SR_ERRORS         (FLASH_SR_PGSERR | FLASH_SR_PGPERR | \
+                                 FLASH_SR_PGAERR | FLASH_SR_WRPERR | FLASH_SR_OPERR)
+
+static const struct {
+	uint8_t number;
+	uintptr_t address;
+} sectors[JOURNAL_NB_SECTORS] = {
+	{ 10, 0x080C0000 },
+	{ 11, 0x080E0000 },
+};
+
+// From the linker script: the initial values of .data are the last part of the
+// firmware image in flash, at _textdata.
+extern uint32_t _textdata;
+extern uint32_t _data;
+extern uint32_t _edata;
+
+/*===========================================================================*/
+/* Module local variables.                                                   */
+/*===========================================================================*/
+
+static unsigned active_sector;
+static uint32_t active_sequence;
+static uint32_t write_offset; // offset of the next record in the active sector
+
+/*===========================================================================*/
+/* Module local functions.                                                   */
+/*===========================================================================*/
+
+static const volatile uint8_t *sector_data(unsigned sector) {
+	return (const volatile uint8_t *)sectors[sector].address;
+}
+
+static uint32_t sector_sequence(unsigned sector) {
+	return *(const volatile uint32_t *)sectors[sector].address;
+}
+
+static bool sequence_is_valid(uint32_t sequence) {
+	return sequence != JOURNAL_ERASED_WORD && sequence != JOURNAL_OBSOLETE;
+}
+
+static void flash_wait(void) {
+	while (FLASH->SR & FLASH_SR_BSY);
+}
+
+static void flash_unlock(void) {
+	flash_wait();
+	if (FLASH->CR & FLASH_CR_LOCK) {
+		FLASH->KEYR = FLASH_KEY1;
+		FLASH->KEYR = FLASH_KEY2;
+	}
+	FLASH->SR = FLASH_SR_ERRORS | FLASH_SR_EOP;
+}
+
+static void flash_lock(void) {
+	flash_wait();
+	FLASH->CR |= FLASH_CR_LOCK;
+}
+
+// The flash must be unlocked.
+static void flash_program_byte(uintptr_t address, uint8_t value) {
+	FLASH->CR &= ~FLASH_CR_PSIZE; // x8 parallelism
+	FLASH->CR |= FLASH_CR_PG;
+	*(volatile uint8_t *)address = value;
+	flash_wait();
+	FLASH->CR &= ~FLASH_CR_PG;
+}
+
+// The flash must be unlocked.
+static void flash_program_word(uintptr_t address, uint32_t value) {
+	FLASH->CR &= ~FLASH_CR_PSIZE;
+	FLASH->CR |= FLASH_CR_PSIZE_1 | FLASH_CR_PG; // x32 parallelism
+	*(volatile uint32_t *)address = value;
+	flash_wait();
+	FLASH->CR &= ~FLASH_CR_PG;
+}
+
+// The flash must be unlocked. This stalls the CPU for about a second.
+static void flash_erase_sector(unsigned sector) {
+	FLASH->CR &= ~(FLASH_CR_PSIZE | FLASH_CR_SNB);
+	FLASH->CR |= FLASH_CR_PSIZE_1 | FLASH_CR_SER
+	           | (sectors[sector].number << FLASH_CR_SNB_SHIFT);
+	FLASH->CR |= FLASH_CR_STRT;
+	flash_wait();
+	FLASH->CR &= ~FLASH_CR_SER;
+
+	// don't let the caches serve the old content
+	FLASH->ACR &= ~FLASH_ACR_DCEN;
+	FLASH->ACR |= FLASH_ACR_DCRST;
+	FLASH->ACR &= ~FLASH_ACR_DCRST;
+	FLASH->ACR |= FLASH_ACR_DCEN;
+}
+
+static bool sector_is_erased(unsigned sector) {
+	const volatile uint32_t *data = (const volatile uint32_t *)sectors[sector].address;
+	for (uint32_t i = 0; i < JOURNAL_SECTOR_SIZE / sizeof(uint32_t); i++)
+		if (data[i] != JOURNAL_ERASED_WORD)
+			return false;
+	return true;
+}
+
+// The flash must be unlocked.
+static void prepare_sector(unsigned sector) {
+	if (!sector_is_erased(sector))
+		flash_erase_sector(sector);
+}
+
+static bool append_record(uint8_t record) {
+	if (write_offset >= JOURNAL_SECTOR_SIZE)
+		return false;
+
+	flash_unlock();
+	flash_program_byte(sectors[active_sector].address + write_offset, record);
+	flash_lock();
+	write_offset++;
+	return true;
+}
+
+/*===========================================================================*/
+/* Module exported functions.                                                */
+/*===========================================================================*/
+
+void path_journal_init(void) {
+	uint32_t sequence[JOURNAL_NB_SECTORS];
+	bool found = false;
+
+	// the linker script of the library doesn't reserve the sectors, so make sure
+	// that the firmware didn't grow into them before erasing anything
+	uintptr_t image_end = (uintptr_t)&_textdata
+	                    + ((uintptr_t)&_edata - (uintptr_t)&_data);
+	if (image_end > sectors[0].address)
+		chSysHalt("firmware overlaps the path journal");
+
+	for (unsigned i = 0; i < JOURNAL_NB_SECTORS; i++) {
+		sequence[i] = sector_sequence(i);
+		if (sequence_is_valid(sequence[i])
+		    && (!found || sequence[i] > active_sequence)) {
+			active_sector = i;
+			active_sequence = sequence[i];
+			found = true;
+		}
+	}
+
+	if (!found) {
+		// first use: format the first sector
+		flash_unlock();
+		prepare_sector(0);
+		flash_program_word(sectors[0].address, 1);
+		flash_lock();
+		active_sector = 0;
+		active_sequence = 1;
+	}
+
+	const volatile uint8_t *data = sector_data(active_sector);
+	write_offset = JOURNAL_HEADER_SIZE;
+	while (write_offset < JOURNAL_SECTOR_SIZE && data[write_offset] != JOURNAL_ERASED_BYTE)
+		write_offset++;
+}
+
+void path_journal_replay(bool (*push)(action_t action)) {
+	const volatile uint8_t *data = sector_data(active_sector);
+
+	// only the actions after the last reset matter
+	uint32_t start = JOURNAL_HEADER_SIZE;
+	for (uint32_t i = JOURNAL_HEADER_SIZE; i < write_offset; i++)
+		if (data[i] == JOURNAL_RESET)
+			start = i + 1;
+
+	for (uint32_t i = start; i < write_offset; i++)
+		push(data[i]); // a record torn by a power loss is rejected here
+}
+
+bool path_journal_append(action_t action) {
+	return append_record(action);
+}
+
+bool path_journal_reset(void) {
+	return append_record(JOURNAL_RESET);
+}
+
+void path_journal_rewrite(action_iterator_t *path) {
+	unsigned old_sector = active_sector;
+	unsigned new_sector = (active_sector + 1) % JOURNAL_NB_SECTORS;
+	uintptr_t address = sectors[new_sector].address;
+
+	flash_unlock();
+	prepare_sector(new_sector);
+
+	write_offset = JOURNAL_HEADER_SIZE;
+	for (action_t action; (action = action_iterator_next(path))
+	                      && write_offset < JOURNAL_SECTOR_SIZE;)
+		flash_program_byte(address + write_offset++, action);
+
+	// the new sector only becomes valid now that it is complete
+	active_sequence++;
+	flash_program_word(address, active_sequence);
+	flash_program_word(sectors[old_sector].address, JOURNAL_OBSOLETE);
+	flash_lock();
+
+	active_sector = new_sector;
+}
@@ -0,0 +1,53 @@
+/**
+ * @file    path_journal.h
+ * @brief   Keeps the saved path in flash, so that it survives a reset.
+ *
+ * Every action pushed to the saved path is appended as one byte to a journal
+ * in a flash sector. Two sectors are used in turn: when the active one is full,
+ * the current path is rewritten at the start of the other one, so each sector
+ * is only erased once every 128k actions.
+ * This uses the last two sectors of the flash (10 and 11), the firmware must
+ * not grow into them: path_journal_init halts the system if it does.
+ */
+
+#ifndef _PATH_JOURNAL_H_
+#define _PATH_JOURNAL_H_
+
+#include <stdbool.h>
+
+#include "action_queue.h"
+
+/*===========================================================================*/
+/*  External declarations                                                    */
+/*===========================================================================*/
+
+/**
+ * @brief           Finds the active sector, formats the journal on first use.
+ * @note            Formatting erases a sector, which stalls the CPU for ~1s.
+ */
+void path_journal_init(void);
+
+/**
+ * @brief           Calls `push` for every action recorded since the last reset.
+ */
+void path_journal_replay(bool (*push)(action_t action));
+
+/**
+ * @brief           Appends an action to the journal.
+ * @return          false if the sector is full, call path_journal_rewrite then.
+ */
+bool path_journal_append(action_t action);
+
+/**
+ * @brief           Records that the saved path was reset.
+ * @return          false if the sector is full, call path_journal_rewrite then.
+ */
+bool path_journal_reset(void);
+
+/**
+ * @brief           Moves to the other sector, holding only the given path.
+ * @note            This erases a sector, only call it while the robot is stopped.
+ */
+void path_journal_rewrite(action_iterator_t *path);
+
+#endif /* _PATH_JOURNAL_H_ */
@@ -0,0 +1,64 @@
+/**
+ * @file    pid.c
+ * @brief   PID controller
+ */
+
+#include <stdbool.h>
+
+// Module headers
+#include "pid.h"
+
+#define CLAMP(a, min, max) (((a)<(min)) ? (min) : (((a)>(max))? (max) : (a)))
+
+/*===========================================================================*/
+/* Module exported functions.                                                */
+/*===========================================================================*/
+
+void pid_init(pid_controller_t *pid, float kp, float ki, float kd,
+              float out_min, float out_max)
+{
+	pid->kp = kp;
+	pid->ki = ki;
+	pid->kd = kd;
+	pid->out_min = out_min;
+	pid->out_max = out_max;
+	pid->frozen = false;
+	pid_reset(pid);
+}
+
+void pid_reset(pid_controller_t *pid)
+{
+	pid->integral = 0.0f;
+	pid->last_measurement = 0.0f;
+	pid->primed = false;
+}
+
+void pid_freeze_integral(pid_controller_t *pid, bool frozen)
+{
+	pid->frozen = frozen;
+}
+
+float pid_update(pid_controller_t *pid, float setpoint, float measurement, float dt)
+{
+	float error = setpoint - measurement;
+
+	float derivative = 0.0f;
+	if(pid->primed && dt > 0.0f)
+		derivative = -(measurement - pid->last_measurement) / dt;
+	pid->last_measurement = measurement;
+	pid->primed = true;
+
+	float proportional = pid->kp * error;
+	float differential = pid->kd * derivative;
+	float output = proportional + pid->integral + differential;
+
+	//only integrate when it does not push further into saturation
+	float step = pid->ki * error * dt;
+	if(!pid->frozen && (output < pid->out_max || step < 0.0f) &&
+	   (output > pid->out_min || step > 0.0f)){
+		pid->integral = CLAMP(pid->integral + step, pid->out_min, pid->out_max);
+		output = proportional + pid->integral + differential;
+	}
+
+	return CLAMP(output, pid->out_min, pid->out_max);
+}
@@ -0,0 +1,59 @@
+/**
+ * @file    pid.h
+ * @brief   PID controller, one instance per regulated quantity.
+ *
+ * The derivative acts on the measurement rather than on the error, so a
+ * change of setpoint or a reset gives no kick, and the integral is frozen
+ * while the output is saturated (anti-windup). Gains are per second, the
+ * time between two updates is given to every update.
+ */
+
+#ifndef _PID_H_
+#define _PID_H_
+
+#include <stdbool.h>
+
+/*===========================================================================*/
+/*  Module data structures and types                                         */
+/*===========================================================================*/
+
+typedef struct {
+	float kp;
+	float ki;                   // [1/s]
+	float kd;                   // [s]
+	float out_min;
+	float out_max;
+	float integral;             // ki * sum(error * dt), within the output range
+	float last_measurement;
+	bool primed;                // last_measurement is valid
+	bool frozen;                // the integral is held, see pid_freeze_integral
+} pid_controller_t;
+
+/*===========================================================================*/
+/*  External declarations                                                    */
+/*===========================================================================*/
+
+void pid_init(pid_controller_t *pid, float kp, float ki, float kd,
+              float out_min, float out_max);
+
+/**
+ * @brief           Forgets the integral and the previous measurement.
+ */
+void pid_reset(pid_controller_t *pid);
+
+/**
+ * @brief           Holds the integral as it is, or lets it integrate again.
+ *                  For the times the setpoint is known to move in a way the
+ *                  integral must not learn, e.g. during a transition.
+ */
+void pid_freeze_integral(pid_controller_t *pid, bool frozen);
+
+/**
+ * @brief           Computes the output for a new measurement.
+ *
+ * @param dt        [s] since the previous update.
+ * @return          The output, within [out_min, out_max].
+ */
+float pid_update(pid_controller_t *pid, float setpoint, float measurement, float dt);
+
+#endif /* _PID_H_ */
@@ -0,0 +1,90 @@
+/**
+ * @file    fft_bench.c
+ * @brief   RAM, accuracy and host time of the FFT backend it is built with.
+ *
+ * The Makefile builds it once per FFT_BACKEND, against the C sources of
+ * CMSIS-DSP. The frame is the one mic_detection analyses: FFT_SIZE fused
+ * samples at MIC_SAMPLE_RATE, with a command tone and noise. The magnitudes
+ * of the command bins are compared with a double precision DFT.
+ * The host time is not a cycle count: CMSIS-DSP is built for a generic core
+ * (ARM_MATH_CM0), without the DSP instructions and the FPU of the M4, and
+ * runs on the host CPU. It only ranks the backends. The cycles of each
+ * backend are counted on the robot, see FFT_CYCLES in the Makefile of the
+ * project.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "arm_fft.h"
+
+#define FFT_SIZE            1024
+#define MIN_BIN             10
+#define NB_BINS             21
+#define TONE_BIN            22
+#define TONE_AMPLITUDE      4000
+#define NOISE_AMPLITUDE     500
+#define NB_RUNS             20000
+#define PI                  3.14159265358979323846
+
+static double now_us(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e6 + t.tv_nsec / 1e3;
+}
+
+int main(void)
+{
+	static int16_t frame[FFT_SIZE], samples[FFT_SIZE];
+	float magnitude[NB_BINS];
+	double reference[NB_BINS];
+
+	srand(1);
+	for(int i = 0 ; i < FFT_SIZE ; i++){
+		double tone = TONE_AMPLITUDE * sin(2 * PI * TONE_BIN * i / FFT_SIZE);
+		double noise = NOISE_AMPLITUDE * (2.0 * rand() / RAND_MAX - 1);
+		frame[i] = (int16_t)lround(tone + noise);
+	}
+
+	for(int b = 0 ; b < NB_BINS ; b++){
+		double re = 0, im = 0;
+		for(int i = 0 ; i < FFT_SIZE ; i++){
+			re += frame[i] * cos(2 * PI * (MIN_BIN + b) * i / FFT_SIZE);
+			im -= frame[i] * sin(2 * PI * (MIN_BIN + b) * i / FFT_SIZE);
+		}
+		reference[b] = sqrt(re * re + im * im);
+	}
+
+	//the q15 backend works in place
+	memcpy(samples, frame, sizeof(samples));
+	if(!fft_compute(FFT_SIZE, samples)){
+		printf("%s: size %d not supported\n", FFT_BACKEND_NAME, FFT_SIZE);
+		return EXIT_FAILURE;
+	}
+	fft_band_magnitude(MIN_BIN, NB_BINS, magnitude);
+
+	double peak = reference[TONE_BIN - MIN_BIN];
+	double worst_error = 0;
+	for(int b = 0 ; b < NB_BINS ; b++){
+		double error = fabs(magnitude[b] - reference[b]) / peak;
+		if(error > worst_error)
+			worst_error = error;
+	}
+
+	double start = now_us();
+	for(int r = 0 ; r < NB_RUNS ; r++){
+		memcpy(samples, frame, sizeof(samples));
+		fft_compute(FFT_SIZE, samples);
+		fft_band_magnitude(MIN_BIN, NB_BINS, magnitude);
+	}
+	double host_us = (now_us() - start) / NB_RUNS;
+
+	printf("%-8s %4d points: %5u bytes of buffers, worst error %.2e of the peak, "
+	       "host time %7.2f us (not cycles)\n", FFT_BACKEND_NAME, FFT_SIZE,
+	       (unsigned)FFT_BUFFER_BYTES, worst_error, host_us);
+	return EXIT_SUCCESS;
+}
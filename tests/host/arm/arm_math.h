@@ -0,0 +1,51 @@
+/**
+ * @file    arm_math.h
+ * @brief   Portable C versions of the few CMSIS-DSP functions and Cortex-M4
+ *          SIMD instructions the Goertzel detection uses, with the same
+ *          results, so that it runs on a host without CMSIS.
+ *          Builds that need the CMSIS FFTs use the real header instead.
+ */
+
+#ifndef _HOST_ARM_MATH_H_
+#define _HOST_ARM_MATH_H_
+
+#include <math.h>
+#include <stdint.h>
+
+#define PI                      3.14159265358979f
+
+typedef int16_t q15_t;
+typedef float float32_t;
+
+typedef enum {
+	ARM_MATH_SUCCESS = 0,
+	ARM_MATH_ARGUMENT_ERROR = -1,
+} arm_status;
+
+static inline arm_status arm_sqrt_f32(float32_t in, float32_t *out)
+{
+	if(in < 0){
+		*out = 0;
+		return ARM_MATH_ARGUMENT_ERROR;
+	}
+	*out = sqrtf(in);
+	return ARM_MATH_SUCCESS;
+}
+
+//both halfword halves added and halved, without overflow
+static inline uint32_t __SHADD16(uint32_t a, uint32_t b)
+{
+	int32_t low = ((int32_t)(int16_t)a + (int16_t)b) >> 1;
+	int32_t high = ((int32_t)(int16_t)(a >> 16) + (int16_t)(b >> 16)) >> 1;
+	return ((uint32_t)high << 16) | ((uint32_t)low & 0xFFFF);
+}
+
+//dual signed multiply of the halves, then sum of the products
+static inline uint32_t __SMUAD(uint32_t a, uint32_t b)
+{
+	int32_t low = (int32_t)(int16_t)a * (int16_t)b;
+	int32_t high = (int32_t)(int16_t)(a >> 16) * (int16_t)(b >> 16);
+	return (uint32_t)(low + high);
+}
+
+#endif /* _HOST_ARM_MATH_H_ */
@@ -0,0 +1,48 @@
+/**
+ * @file    ch.h
+ * @brief   Just enough of the ChibiOS API to build the modules that don't touch
+ *          the hardware on a host, for the tests in this folder. There is a
+ *          single thread, so the locks do nothing and nothing ever blocks.
+ */
+
+#ifndef _HOST_CH_H_
+#define _HOST_CH_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef uint32_t systime_t;
+typedef uint32_t syssts_t;
+typedef int32_t msg_t;
+
+#define TRUE                    1
+#define FALSE                   0
+#define MSG_OK                  0
+#define MSG_TIMEOUT             -1
+#define TIME_IMMEDIATE          ((systime_t)0)
+#define TIME_INFINITE           ((systime_t)-1)
+#define CH_CFG_ST_FREQUENCY     1000
+#define MS2ST(ms)               ((systime_t)(ms))
+#define ST2MS(st)               ((uint32_t)(st))
+
+typedef struct {
+	bool signaled;
+} binary_semaphore_t;
+
+#define BSEMAPHORE_DECL(name, taken)    binary_semaphore_t name = {!(taken)}
+
+syssts_t chSysGetStatusAndLockX(void);
+void chSysRestoreStatusX(syssts_t status);
+void chSysLock(void);
+void chSysUnlock(void);
+void chSysHalt(const char *reason);
+
+void chBSemSignalI(binary_semaphore_t *bsp);
+msg_t chBSemWaitTimeout(binary_semaphore_t *bsp, systime_t timeout);
+
+systime_t chVTGetSystemTime(void);
+systime_t chVTGetSystemTimeX(void);
+systime_t chVTTimeElapsedSinceX(systime_t start);
+
+#endif /* _HOST_CH_H_ */
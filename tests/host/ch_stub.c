@@ -0,0 +1,68 @@
+/**
+ * @file    ch_stub.c
+ * @brief   Single threaded stand-ins for the ChibiOS functions of host/ch.h.
+ *          The system time is the host monotonic clock.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "ch.h"
+
+syssts_t chSysGetStatusAndLockX(void)
+{
+	return 0;
+}
+
+void chSysRestoreStatusX(syssts_t status)
+{
+	(void)status;
+}
+
+void chSysLock(void)
+{
+}
+
+void chSysUnlock(void)
+{
+}
+
+void chSysHalt(const char *reason)
+{
+	fprintf(stderr, "chSysHalt: %s\n", reason);
+	abort();
+}
+
+void chBSemSignalI(binary_semaphore_t *bsp)
+{
+	bsp->signaled = true;
+}
+
+msg_t chBSemWaitTimeout(binary_semaphore_t *bsp, systime_t timeout)
+{
+	(void)timeout;
+	//nobody else can signal it while we wait
+	if(!bsp->signaled)
+		return MSG_TIMEOUT;
+	bsp->signaled = false;
+	return MSG_OK;
+}
+
+systime_t chVTGetSystemTimeX(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (systime_t)(now.tv_sec * CH_CFG_ST_FREQUENCY
+	                   + now.tv_nsec / (1000000000 / CH_CFG_ST_FREQUENCY));
+}
+
+systime_t chVTGetSystemTime(void)
+{
+	return chVTGetSystemTimeX();
+}
+
+systime_t chVTTimeElapsedSinceX(systime_t start)
+{
+	return chVTGetSystemTimeX() - start;
+}
@@ -0,0 +1,9 @@
+/**
+ * @file    hal.h
+ * @brief   Nothing of the HAL is used by the modules built on the host.
+ */
+
+#ifndef _HOST_HAL_H_
+#define _HOST_HAL_H_
+
+#endif /* _HOST_HAL_H_ */
@@ -0,0 +1,290 @@
+/**
+ * @file    mic_replay.c
+ * @brief   Runs a recording through the command detection of the robot.
+ *
+ * usage: mic_replay recording.wav [labels.txt]
+ *
+ * The recording is 16 bits PCM at MIC_SAMPLE_RATE, either mono or the four
+ * mics of the robot interleaved in the order of the mic driver (right, left,
+ * back, front). It is cut in blocks of MIC_BLOCK_SIZE samples per mic, which
+ * go through mic_detection_fuse (four mics only) and mic_detection_process,
+ * as they do in process_audio_data and dsp_thd.
+ *
+ * The detected actions are printed with the time of the end of the block they
+ * were detected in, and the time spent on every block is reported.
+ * The labels are the ones Audacity exports: "start end actions" per line,
+ * in seconds, e.g. "1.5 1.8 L" or "4.0 6.2 SSL" for a dual tone frame. With
+ * them, every detection is matched in order with the expected actions, the
+ * latency of each label is from its start to its last action, and the exit
+ * status tells if any action was missed or added.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mic_detection.h"
+
+#define MIC_BLOCK_SIZE          160     // samples per mic in each callback
+#define MIC_NB_CHANNELS         4
+#define MAX_DETECTIONS          1024
+#define MAX_LABELS              256
+#define MAX_LABEL_ACTIONS       64
+
+#define WAV_FORMAT_PCM          1
+#define WAV_FORMAT_EXTENSIBLE   0xFFFE
+
+typedef struct {
+	action_t action;
+	double time;                // [s]
+} detection_t;
+
+typedef struct {
+	double start;               // [s]
+	char actions[MAX_LABEL_ACTIONS + 1];
+} label_t;
+
+static detection_t detections[MAX_DETECTIONS];
+static unsigned nb_detections = 0;
+//end of the block being processed, the time of the detections
+static double block_end_time = 0;
+
+/*===========================================================================*/
+/* Input files.                                                              */
+/*===========================================================================*/
+
+static uint32_t read_le(const uint8_t *p, unsigned nb_bytes)
+{
+	uint32_t value = 0;
+	for(unsigned i = nb_bytes ; i > 0 ; i--)
+		value = (value << 8) | p[i - 1];
+	return value;
+}
+
+/**
+ * @brief           Loads the samples of a WAV file.
+ * @return          Interleaved samples, NULL on error
+ */
+static int16_t *read_wav(const char *path, uint16_t *nb_channels, uint32_t *nb_frames)
+{
+	FILE *file = fopen(path, "rb");
+	if(!file){
+		perror(path);
+		return NULL;
+	}
+
+	uint8_t header[12], chunk[8], fmt[16];
+	int16_t *samples = NULL;
+	bool has_fmt = false;
+
+	if(fread(header, 1, sizeof(header), file) != sizeof(header)
+	   || memcmp(header, "RIFF", 4) || memcmp(header + 8, "WAVE", 4)){
+		fprintf(stderr, "%s: not a WAV file\n", path);
+		goto done;
+	}
+
+	while(fread(chunk, 1, sizeof(chunk), file) == sizeof(chunk)){
+		uint32_t size = read_le(chunk + 4, 4);
+
+		if(!memcmp(chunk, "fmt ", 4) && size >= sizeof(fmt)){
+			if(fread(fmt, 1, sizeof(fmt), file) != sizeof(fmt))
+				break;
+			uint16_t format = read_le(fmt, 2);
+			*nb_channels = read_le(fmt + 2, 2);
+			uint32_t rate = read_le(fmt + 4, 4);
+			uint16_t bits = read_le(fmt + 14, 2);
+			if((format != WAV_FORMAT_PCM && format != WAV_FORMAT_EXTENSIBLE) || bits != 16
+			   || rate != MIC_SAMPLE_RATE
+			   || (*nb_channels != 1 && *nb_channels != MIC_NB_CHANNELS)){
+				fprintf(stderr, "%s: need 16 bits PCM at %d Hz, with 1 or %d channels\n",
+				        path, MIC_SAMPLE_RATE, MIC_NB_CHANNELS);
+				goto done;
+			}
+			has_fmt = true;
+			fseek(file, size - sizeof(fmt) + (size & 1), SEEK_CUR);
+		}else if(!memcmp(chunk, "data", 4) && has_fmt){
+			*nb_frames = size / (2 * *nb_channels);
+			samples = malloc((size_t)*nb_frames * *nb_channels * sizeof(int16_t));
+			if(!samples || fread(samples, 2 * *nb_channels, *nb_frames, file) != *nb_frames){
+				fprintf(stderr, "%s: truncated data\n", path);
+				free(samples);
+				samples = NULL;
+			}
+			//the samples are little-endian, like the hosts this runs on
+			goto done;
+		}else{
+			fseek(file, size + (size & 1), SEEK_CUR);
+		}
+	}
+	fprintf(stderr, "%s: no samples found\n", path);
+
+done:
+	fclose(file);
+	return samples;
+}
+
+static int read_labels(const char *path, label_t *labels)
+{
+	FILE *file = fopen(path, "r");
+	if(!file){
+		perror(path);
+		return -1;
+	}
+
+	char line[256];
+	int nb_labels = 0;
+	while(fgets(line, sizeof(line), file) && nb_labels < MAX_LABELS){
+		double end;
+		label_t *label = &labels[nb_labels];
+		if(sscanf(line, "%lf %lf %64s", &label->start, &end, label->actions) == 3)
+			nb_labels++;
+	}
+	fclose(file);
+	return nb_labels;
+}
+
+/*===========================================================================*/
+/* Detection.                                                                */
+/*===========================================================================*/
+
+static void record_action(action_t action)
+{
+	//mic_remote also reports the silence between commands
+	if(action == ACTION_VOID || nb_detections >= MAX_DETECTIONS)
+		return;
+	detections[nb_detections].action = action;
+	detections[nb_detections].time = block_end_time;
+	nb_detections++;
+}
+
+static double elapsed_us(const struct timespec *start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1e6 + (now.tv_nsec - start->tv_nsec) / 1e3;
+}
+
+static void replay(const int16_t *samples, uint16_t nb_channels, uint32_t nb_frames)
+{
+	static int16_t fused[MIC_BLOCK_SIZE];
+	uint32_t nb_blocks = nb_frames / MIC_BLOCK_SIZE;
+	double total_us = 0, worst_us = 0;
+
+	mic_detection_init(&record_action);
+
+	for(uint32_t b = 0 ; b < nb_blocks ; b++){
+		const int16_t *block = &samples[(size_t)b * MIC_BLOCK_SIZE * nb_channels];
+		block_end_time = (double)(b + 1) * MIC_BLOCK_SIZE / MIC_SAMPLE_RATE;
+
+		struct timespec start;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		if(nb_channels == MIC_NB_CHANNELS){
+			mic_detection_fuse(block, MIC_BLOCK_SIZE * MIC_NB_CHANNELS, fused);
+			mic_detection_process(fused, MIC_BLOCK_SIZE);
+		}else{
+			mic_detection_process(block, MIC_BLOCK_SIZE);
+		}
+		double us = elapsed_us(&start);
+
+		total_us += us;
+		if(us > worst_us)
+			worst_us = us;
+	}
+
+	printf("%u blocks of %d samples: %.2f us on average, %.2f us at worst, "
+	       "%.0fx real time\n", nb_blocks, MIC_BLOCK_SIZE,
+	       nb_blocks ? total_us / nb_blocks : 0, worst_us,
+	       total_us > 0 ? nb_blocks * 1e6 * MIC_BLOCK_SIZE / MIC_SAMPLE_RATE / total_us : 0);
+}
+
+/**
+ * @brief           Matches the detections with the labels, in order.
+ * @return          Number of actions missed or added
+ */
+static unsigned check_labels(const label_t *labels, int nb_labels)
+{
+	unsigned d = 0, added = 0, missed = 0;
+	double total_latency = 0, worst_latency = 0;
+	int nb_found = 0;
+
+	for(int l = 0 ; l < nb_labels ; l++){
+		const label_t *label = &labels[l];
+		const char *expected = label->actions;
+		double last_time = 0;
+
+		//the actions before the label can't be for it
+		while(d < nb_detections && detections[d].time < label->start){
+			printf("  %8.3f s  %c  added\n", detections[d].time, detections[d].action);
+			added++;
+			d++;
+		}
+		//in a frame, an extra action is extra, but a wrong one is also a missed one
+		for(; *expected && d < nb_detections ; d++){
+			if(l + 1 < nb_labels && detections[d].time >= labels[l + 1].start)
+				break;
+			if(detections[d].action == *expected){
+				last_time = detections[d].time;
+				expected++;
+			}else{
+				printf("  %8.3f s  %c  added\n", detections[d].time, detections[d].action);
+				added++;
+			}
+		}
+
+		if(*expected){
+			printf("  %8.3f s  %s  missed %s\n", label->start, label->actions, expected);
+			missed += strlen(expected);
+		}else{
+			double latency = last_time - label->start;
+			printf("  %8.3f s  %s  after %.0f ms\n", label->start, label->actions, latency * 1e3);
+			total_latency += latency;
+			if(latency > worst_latency)
+				worst_latency = latency;
+			nb_found++;
+		}
+	}
+	for(; d < nb_detections ; d++){
+		printf("  %8.3f s  %c  added\n", detections[d].time, detections[d].action);
+		added++;
+	}
+
+	printf("%d of %d labels found, %u actions missed, %u added", nb_found, nb_labels,
+	       missed, added);
+	if(nb_found)
+		printf(", latency %.0f ms on average, %.0f ms at worst",
+		       total_latency / nb_found * 1e3, worst_latency * 1e3);
+	printf("\n");
+	return missed + added;
+}
+
+int main(int argc, char **argv)
+{
+	if(argc < 2 || argc > 3){
+		fprintf(stderr, "usage: %s recording.wav [labels.txt]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	uint16_t nb_channels = 0;
+	uint32_t nb_frames = 0;
+	int16_t *samples = read_wav(argv[1], &nb_channels, &nb_frames);
+	if(!samples)
+		return EXIT_FAILURE;
+
+	replay(samples, nb_channels, nb_frames);
+	free(samples);
+
+	if(argc == 2){
+		for(unsigned d = 0 ; d < nb_detections ; d++)
+			printf("  %8.3f s  %c\n", detections[d].time, detections[d].action);
+		return EXIT_SUCCESS;
+	}
+
+	static label_t labels[MAX_LABELS];
+	int nb_labels = read_labels(argv[2], labels);
+	if(nb_labels < 0)
+		return EXIT_FAILURE;
+	return check_labels(labels, nb_labels) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
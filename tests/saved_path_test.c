@@ -0,0 +1,149 @@
+/**
+ * @file    saved_path_test.c
+ * @brief   Checks the run-length encoding of the saved path: every accepted
+ *          action is read back, the worst case holds what action_queue.h
+ *          says, and a full path refuses actions without losing any.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "action_queue.h"
+#include "path_journal.h"
+
+#define NB_RANDOM_PATHS     2000
+#define MAX_RANDOM_LENGTH   600
+#define MAX_LENGTH          (1 << 16)
+#define NB_REFUSED          50
+
+static int failures = 0;
+
+#define CHECK(cond, what) do {                                                  \
+	if(!(cond)){                                                                \
+		if(failures++ < 10)                                                     \
+			printf("FAIL %s:%d: %s, %s\n", __FILE__, __LINE__, #cond, what);    \
+	}                                                                           \
+} while(0)
+
+/*===========================================================================*/
+/* Journal stubs, the saved path is only checked in RAM.                     */
+/*===========================================================================*/
+
+void path_journal_init(void) {}
+void path_journal_replay(bool (*push)(action_t action)) { (void)push; }
+bool path_journal_append(action_t action) { (void)action; return true; }
+bool path_journal_reset(void) { return true; }
+void path_journal_rewrite(action_iterator_t *path) { (void)path; }
+
+/*===========================================================================*/
+/* Helpers.                                                                  */
+/*===========================================================================*/
+
+static action_t pushed[MAX_LENGTH];
+static int nb_pushed;
+
+//pushes and remembers the accepted actions
+static bool push(action_t action)
+{
+	if(!saved_path_push(action))
+		return false;
+	pushed[nb_pushed++] = action;
+	return true;
+}
+
+//the saved path must read back as the accepted actions
+static void check_read_back(const char *what)
+{
+	action_iterator_t it;
+	action_t action;
+	int i = 0;
+
+	get_saved_path(&it);
+	while((action = action_iterator_next(&it)) && i < nb_pushed){
+		if(action != pushed[i])
+			break;
+		i++;
+	}
+	CHECK(i == nb_pushed && action == ACTION_VOID, what);
+}
+
+static action_t random_action(void)
+{
+	//mostly straight, so that runs of all lengths come up
+	int r = rand() % 10;
+	return r < 6 ? ACTION_STRAIGHT : "LRB"[r % 3];
+}
+
+/*===========================================================================*/
+/* Tests.                                                                    */
+/*===========================================================================*/
+
+static void test_random_paths(void)
+{
+	for(int i = 0 ; i < NB_RANDOM_PATHS ; i++){
+		reset_saved_path();
+		nb_pushed = 0;
+		int length = rand() % MAX_RANDOM_LENGTH;
+		for(int j = 0 ; j < length ; j++)
+			push(random_action());
+		CHECK(nb_pushed == length, "random path refused");
+		check_read_back("random path");
+	}
+	printf("random paths: %d read back\n", NB_RANDOM_PATHS);
+}
+
+static void test_worst_case(void)
+{
+	static const action_t pattern[] = "SSSL";
+
+	reset_saved_path();
+	nb_pushed = 0;
+	while(push(pattern[nb_pushed % 4]));
+	CHECK(nb_pushed * 5 >= 16 * SAVED_PATH_BYTES, "worst case below 3.2 per byte");
+	check_read_back("worst case");
+
+	//full: everything is refused, and nothing is lost
+	int before = nb_pushed;
+	for(int i = 0 ; i < NB_REFUSED ; i++)
+		push(random_action());
+	CHECK(nb_pushed == before, "full path accepted an action");
+	check_read_back("worst case, after refusals");
+
+	printf("worst case \"SSSL\": %d actions in %d bytes\n", nb_pushed, SAVED_PATH_BYTES);
+}
+
+//fills the path with random actions, then checks that the refusals lose nothing
+static void test_full_paths(void)
+{
+	int min_length = MAX_LENGTH;
+
+	for(int i = 0 ; i < 20 ; i++){
+		reset_saved_path();
+		nb_pushed = 0;
+		for(int refused = 0 ; refused < NB_REFUSED && nb_pushed < MAX_LENGTH ;){
+			if(!push(random_action()))
+				refused++;
+		}
+		check_read_back("full random path");
+		if(nb_pushed < min_length)
+			min_length = nb_pushed;
+	}
+	CHECK(min_length * 5 >= 16 * SAVED_PATH_BYTES, "full path below 3.2 per byte");
+	printf("full random paths: at least %d actions in %d bytes\n", min_length, SAVED_PATH_BYTES);
+}
+
+int main(void)
+{
+	srand(1);
+	test_random_paths();
+	test_worst_case();
+	test_full_paths();
+
+	if(failures){
+		printf("%d failures\n", failures);
+		return EXIT_FAILURE;
+	}
+	printf("all passed\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,337 @@
+/**
+ * @file    simplify_test.c
+ * @brief   Compares simplify_action_list with the multi-pass implementation it
+ *          replaced, and times both.
+ *
+ * The rules and the order they are applied in are the same, but the old
+ * implementation stops after a pass that made no ACTION_BACK, even when that
+ * pass made a new pattern, e.g. "LBLBR" gave "SBR" instead of "L". Running it
+ * again on its own output then gives the new result. So the new output must be
+ * the old one run until it doesn't change anymore, exactly, and so must the
+ * simplified saved path.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "action_queue.h"
+#include "path_journal.h"
+
+#define NB_RANDOM_LISTS     200000
+#define MAX_RANDOM_LENGTH   40
+#define NB_MAZES            2000
+#define MAZE_WIDTH          24
+#define MAZE_HEIGHT         24
+#define MAX_LENGTH          (1 << 12)
+#define BENCH_LENGTH        2048
+#define BENCH_RUNS          200
+
+static int failures = 0;
+
+#define CHECK(cond, list) do {                                                  \
+	if(!(cond)){                                                                \
+		if(failures++ < 10)                                                     \
+			printf("FAIL %s:%d: %s for \"%s\"\n", __FILE__, __LINE__, #cond, list); \
+	}                                                                           \
+} while(0)
+
+/*===========================================================================*/
+/* Journal stubs, action_queue.c is linked for simplify_action_list only.    */
+/*===========================================================================*/
+
+void path_journal_init(void) {}
+void path_journal_replay(bool (*push)(action_t action)) { (void)push; }
+bool path_journal_append(action_t action) { (void)action; return true; }
+bool path_journal_reset(void) { return true; }
+void path_journal_rewrite(action_iterator_t *path) { (void)path; }
+
+/*===========================================================================*/
+/* The implementation before the rewrite rules, verbatim but for the names.  */
+/*===========================================================================*/
+
+static int old_to_int(action_t direction) {
+	if (direction == ACTION_BACK) return 0;
+	if (direction == ACTION_STRAIGHT) return 1;
+	if (direction == ACTION_LEFT) return 2;
+	if (direction == ACTION_RIGHT) return 3;
+	return -1;
+}
+
+static const int old_table[4][4] =
+	{
+		{ -1, -1, -1, -1 }, // first is BACK
+		{ -1,  0,  3,  2 }, // first is STRAIGHT
+		{ -1,  3,  1,  0 }, // first is LEFT
+		{ -1,  2,  0,  1 }, // first is RIGHT
+	};
+static action_t collapse_three_actions(action_t a, action_t b, action_t c) {
+	int first  = old_to_int(a);
+	int second = old_to_int(b);
+	int third  = old_to_int(c);
+
+	if (second != 0)
+		return ACTION_VOID; // this function can't simplify this
+
+	int result = old_table[first][third];
+
+	if (result == 0) return ACTION_BACK;
+	if (result == 1) return ACTION_STRAIGHT;
+	if (result == 2) return ACTION_LEFT;
+	if (result == 3) return ACTION_RIGHT;
+	return ACTION_VOID;
+}
+
+static bool simplify_once(action_t *const actions) {
+	char *p = actions; // front of the simplified list
+	char *q = actions; // front of the original list
+	bool needs_another_pass = false;
+
+	char *end = actions;
+	while (*end != ACTION_VOID) end++;
+	// end now points to the ACTION_VOID at the end
+
+	while (q != end && q != end-1 && q != end-2) {
+		char result = collapse_three_actions(*q, *(q+1), *(q+2));
+		if (result) {
+			*p++ = result;
+			q+=3;
+
+			if (result == ACTION_BACK)
+				needs_another_pass = true;
+		} else {
+			*p++ = *q++;
+		}
+	}
+
+	// nothing else we can collapse, let's just copy
+	while (q != end)
+		*p++ = *q++;
+	*p = ACTION_VOID;
+
+	return needs_another_pass;
+}
+
+static void old_simplify_action_list(action_t *const actions) {
+	while(simplify_once(actions));
+}
+
+/*===========================================================================*/
+/* Helpers.                                                                  */
+/*===========================================================================*/
+
+//runs the old implementation until its output doesn't change anymore
+static void old_simplify_to_fixpoint(action_t *actions)
+{
+	static action_t previous[MAX_LENGTH];
+	do {
+		strcpy(previous, actions);
+		old_simplify_action_list(actions);
+	} while(strcmp(previous, actions));
+}
+
+//pushes `actions` to the saved path, and reads back its simplified form
+static void simplify_saved_path(const action_t *actions, action_t *simplified)
+{
+	action_iterator_t it;
+
+	reset_saved_path();
+	for(; *actions ; actions++)
+		saved_path_push(*actions);
+	get_simplified_saved_path(&it);
+	while((*simplified = action_iterator_next(&it)) != ACTION_VOID)
+		simplified++;
+}
+
+static void random_list(action_t *actions, int length)
+{
+	for(int i = 0 ; i < length ; i++)
+		actions[i] = "SLRB"[rand() % 4];
+	actions[length] = ACTION_VOID;
+}
+
+/*===========================================================================*/
+/* Left-wall exploration of a random perfect maze.                           */
+/*===========================================================================*/
+
+//headings, counterclockwise
+static const int dx[4] = {0, -1, 0, 1};
+static const int dy[4] = {1, 0, -1, 0};
+static bool open[MAZE_WIDTH][MAZE_HEIGHT][4];
+static bool visited[MAZE_WIDTH][MAZE_HEIGHT];
+
+static bool inside(int x, int y)
+{
+	return x >= 0 && y >= 0 && x < MAZE_WIDTH && y < MAZE_HEIGHT;
+}
+
+static void carve(int x, int y)
+{
+	int order[4] = {0, 1, 2, 3};
+	visited[x][y] = true;
+	for(int i = 3 ; i > 0 ; i--){
+		int j = rand() % (i + 1);
+		int tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+	for(int i = 0 ; i < 4 ; i++){
+		int h = order[i];
+		int nx = x + dx[h], ny = y + dy[h];
+		if(!inside(nx, ny) || visited[nx][ny])
+			continue;
+		open[x][y][h] = true;
+		open[nx][ny][(h + 2) % 4] = true;
+		carve(nx, ny);
+	}
+}
+
+//as control_maze records it: a turn is followed by the corridor after it
+static int record_move(action_t *actions, int from, int to)
+{
+	actions[0] = "SLBR"[(to - from + 4) % 4];
+	if(actions[0] == ACTION_STRAIGHT)
+		return 1;
+	actions[1] = ACTION_STRAIGHT;
+	return 2;
+}
+
+//returns the length of the exploration
+static int explore_maze(action_t *actions)
+{
+	memset(open, 0, sizeof(open));
+	memset(visited, 0, sizeof(visited));
+	carve(0, 0);
+
+	int x = 0, y = 0, heading = 0, length = 0;
+	while(!(x == MAZE_WIDTH - 1 && y == MAZE_HEIGHT - 1) && length < MAX_LENGTH - 2){
+		//keep the left hand on the wall
+		static const int preferences[4] = {1, 0, 3, 2};
+		for(int i = 0 ; i < 4 ; i++){
+			int h = (heading + preferences[i]) % 4;
+			if(open[x][y][h]){
+				length += record_move(actions + length, heading, h);
+				heading = h;
+				break;
+			}
+		}
+		x += dx[heading];
+		y += dy[heading];
+	}
+	actions[length] = ACTION_VOID;
+	return length;
+}
+
+/*===========================================================================*/
+/* Tests.                                                                    */
+/*===========================================================================*/
+
+static void test_random_lists(void)
+{
+	static action_t input[MAX_LENGTH], new[MAX_LENGTH], old[MAX_LENGTH];
+	int stopped_early = 0;
+
+	for(int i = 0 ; i < NB_RANDOM_LISTS ; i++){
+		random_list(input, rand() % MAX_RANDOM_LENGTH);
+		strcpy(new, input);
+		strcpy(old, input);
+		simplify_action_list(new);
+		old_simplify_action_list(old);
+
+		if(strcmp(new, old)){
+			stopped_early++;
+			old_simplify_to_fixpoint(old);
+		}
+		CHECK(!strcmp(new, old), input);
+	}
+	printf("random lists: %d, old stopped early on %d\n", NB_RANDOM_LISTS, stopped_early);
+}
+
+static void test_mazes(void)
+{
+	static action_t input[MAX_LENGTH + 1], new[MAX_LENGTH + 1], old[MAX_LENGTH + 1];
+	static action_t saved[MAX_LENGTH + 1];
+	int stopped_early = 0;
+
+	for(int i = 0 ; i < NB_MAZES ; i++){
+		int length = explore_maze(input);
+		strcpy(new, input);
+		strcpy(old, input);
+		simplify_action_list(new);
+		old_simplify_action_list(old);
+
+		if(strcmp(new, old)){
+			stopped_early++;
+			old_simplify_to_fixpoint(old);
+		}
+		CHECK(!strcmp(new, old), input);
+		simplify_saved_path(input, saved);
+		CHECK(!strcmp(saved, new), input);
+
+		//reading the simplified path ends the passes, a push starts them again
+		input[length] = "SLRB"[i % 4];
+		input[length + 1] = ACTION_VOID;
+		strcpy(new, input);
+		simplify_action_list(new);
+		saved_path_push(input[length]);
+		action_iterator_t it;
+		action_t *p = saved;
+		get_simplified_saved_path(&it);
+		while((*p = action_iterator_next(&it)) != ACTION_VOID)
+			p++;
+		CHECK(!strcmp(saved, new), input);
+	}
+	printf("mazes: %d, old stopped early on %d\n", NB_MAZES, stopped_early);
+}
+
+static double time_us(void (*simplify)(action_t *const), const action_t *input)
+{
+	static action_t list[MAX_LENGTH];
+	clock_t start = clock();
+	for(int i = 0 ; i < BENCH_RUNS ; i++){
+		strcpy(list, input);
+		simplify(list);
+	}
+	return (clock() - start) * 1e6 / CLOCKS_PER_SEC / BENCH_RUNS;
+}
+
+static void benchmark(void)
+{
+	static action_t input[MAX_LENGTH];
+	int length;
+
+	length = explore_maze(input);
+	printf("bench maze exploration, %4d actions: old %8.1f us, new %8.1f us\n", length,
+	       time_us(&old_simplify_action_list, input), time_us(&simplify_action_list, input));
+
+	random_list(input, BENCH_LENGTH);
+	printf("bench random list,      %4d actions: old %8.1f us, new %8.1f us\n", BENCH_LENGTH,
+	       time_us(&old_simplify_action_list, input), time_us(&simplify_action_list, input));
+
+	//nested dead ends, the old implementation needs one pass per level
+	length = 0;
+	for(int i = 0 ; i < BENCH_LENGTH / 2 ; i++)
+		input[length++] = ACTION_STRAIGHT;
+	input[length++] = ACTION_BACK;
+	for(int i = 0 ; i < BENCH_LENGTH / 2 ; i++)
+		input[length++] = ACTION_STRAIGHT;
+	input[length] = ACTION_VOID;
+	printf("bench nested dead ends, %4d actions: old %8.1f us, new %8.1f us\n", length,
+	       time_us(&old_simplify_action_list, input), time_us(&simplify_action_list, input));
+}
+
+int main(void)
+{
+	srand(1);
+	test_random_lists();
+	test_mazes();
+	benchmark();
+
+	if(failures){
+		printf("%d failures\n", failures);
+		return EXIT_FAILURE;
+	}
+	printf("all passed\n");
+	return EXIT_SUCCESS;
+}
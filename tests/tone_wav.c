@@ -0,0 +1,277 @@
+/**
+ * @file    tone_wav.c
+ * @brief   Writes a recording of tone commands and dual tone frames for
+ *          mic_replay.
+ *
+ * usage: tone_wav recording.wav labels.txt script [channels]
+ *
+ * Every action of the script ('S', 'L', 'R' or 'B') is a single tone of
+ * TONE_DURATION at the bin of its command, followed by as much silence.
+ * Between brackets is a dual tone frame of tone_protocol.h: '[' is START, ']'
+ * is END, and inside:
+ * - 'S', 'L', 'R', 'B' are the action symbols;
+ * - '1' to '8' repeat the previous action that many times;
+ * - ',' is the separator and 'x' cancels the frame;
+ * - '?' before a symbol adds a second tone to its high group at
+ *   WEAK_RIVAL of its amplitude, too strong for the symbol to be heard,
+ *   and '!' one at STRONG_RIVAL, weak enough for it to be.
+ * A frame ended by '>' instead of ']' is truncated: there is no END, and it
+ * is followed by FRAME_TIMEOUT of silence, after which it must be dropped.
+ * e.g. "L[SS2L]R[L?S>B" is a left command, a frame giving "SSSSL", a right
+ * command, a truncated frame, and a U-turn command.
+ *
+ * There is a little noise all along, and each mic gets its own gain. The
+ * labels give the start and the end of each command or frame, with the
+ * actions the robot must get from it, in the format mic_replay reads.
+ * Frames that must give nothing have no label.
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mic_detection.h"
+#include "tone_protocol.h"
+
+#define TONE_DURATION       0.3     // [s]
+#define SYMBOL_DURATION     0.12    // [s]
+#define SYMBOL_GAP          0.15    // [s] long enough to tell equal symbols apart
+#define FRAME_TIMEOUT       2.5     // [s] more than TONE_FRAME_TIMEOUT
+#define LEAD_IN             0.5     // [s]
+#define TONE_AMPLITUDE      3000
+#define SYMBOL_AMPLITUDE    (TONE_AMPLITUDE / 2)    // for each of the two tones
+#define WEAK_RIVAL          0.7     // more than 1/TONE_DOMINANCE
+#define STRONG_RIVAL        0.3
+#define NOISE_AMPLITUDE     50
+#define MAX_CHANNELS        4
+#define MAX_SOUNDS          1024
+#define MAX_SIMULTANEOUS    3
+#define MAX_FRAME_ACTIONS   64
+
+//The command bins of mic_detection.c, in a FFT_SIZE frame
+#define FFT_SIZE            1024
+#define FREQ_U_TURN         20
+#define FREQ_TURN_LEFT      22
+#define FREQ_TURN_RIGHT     24
+#define FREQ_STRAIGHT       26
+
+//The symbols of tone_protocol.c
+#define SYMBOL_REPEAT       4       // repeat once, then up to 8 times
+#define SYMBOL_SEPARATOR    12
+#define SYMBOL_CANCEL       13
+#define SYMBOL_START        14
+#define SYMBOL_END          15
+
+typedef struct {
+	double start;                   // [s]
+	double duration;                // [s]
+	unsigned nb_tones;
+	double bins[MAX_SIMULTANEOUS];
+	double amplitudes[MAX_SIMULTANEOUS];
+} sound_t;
+
+static const double gains[MAX_CHANNELS] = {1.0, 0.8, 0.6, 0.9};
+static const char symbol_actions[] = "BSLR";
+
+static sound_t sounds[MAX_SOUNDS];
+static unsigned nb_sounds = 0;
+//where the next sound starts
+static double cursor = LEAD_IN;
+
+static int command_bin(char action)
+{
+	switch(action){
+	case ACTION_BACK:       return FREQ_U_TURN;
+	case ACTION_LEFT:       return FREQ_TURN_LEFT;
+	case ACTION_RIGHT:      return FREQ_TURN_RIGHT;
+	case ACTION_STRAIGHT:   return FREQ_STRAIGHT;
+	default:                return -1;
+	}
+}
+
+static sound_t *add_sound(double duration, double silence)
+{
+	if(nb_sounds >= MAX_SOUNDS){
+		fprintf(stderr, "tone_wav: more than %d sounds\n", MAX_SOUNDS);
+		exit(EXIT_FAILURE);
+	}
+	sound_t *sound = &sounds[nb_sounds++];
+	memset(sound, 0, sizeof(*sound));
+	sound->start = cursor;
+	sound->duration = duration;
+	cursor += duration + silence;
+	return sound;
+}
+
+static void add_tone(sound_t *sound, double bin, double amplitude)
+{
+	sound->bins[sound->nb_tones] = bin;
+	sound->amplitudes[sound->nb_tones] = amplitude;
+	sound->nb_tones++;
+}
+
+//`rival` is the amplitude of a second tone in the high group, relative
+static void add_symbol(int symbol, double rival)
+{
+	int low = symbol / TONE_NB_GROUP_BINS;
+	int high = symbol % TONE_NB_GROUP_BINS;
+	sound_t *sound = add_sound(SYMBOL_DURATION, SYMBOL_GAP);
+
+	add_tone(sound, tone_protocol_bins[low], SYMBOL_AMPLITUDE);
+	add_tone(sound, tone_protocol_bins[TONE_NB_GROUP_BINS + high], SYMBOL_AMPLITUDE);
+	if(rival > 0){
+		int other = (high + 1) % TONE_NB_GROUP_BINS;
+		add_tone(sound, tone_protocol_bins[TONE_NB_GROUP_BINS + other], rival * SYMBOL_AMPLITUDE);
+	}
+}
+
+/**
+ * @brief           Adds the symbols of a frame, after its '['.
+ *
+ * @param expected  Receives what the decoder must push, empty if nothing.
+ * @return          The script after the frame, NULL if it is malformed.
+ */
+static const char *add_frame(const char *script, char *expected)
+{
+	unsigned nb_expected = 0;
+	bool cancelled = false;
+
+	add_symbol(SYMBOL_START, 0);
+	for(;; script++){
+		double rival = 0;
+		bool heard = true;
+		if(*script == '?' || *script == '!'){
+			heard = *script == '!';
+			rival = heard ? STRONG_RIVAL : WEAK_RIVAL;
+			script++;
+		}
+
+		const char *action = *script ? strchr(symbol_actions, *script) : NULL;
+		if(action){
+			add_symbol(action - symbol_actions, rival);
+			if(heard && nb_expected < MAX_FRAME_ACTIONS)
+				expected[nb_expected++] = *action;
+		}else if(*script >= '1' && *script <= '8' && nb_expected > 0){
+			int count = *script - '0';
+			add_symbol(SYMBOL_REPEAT + count - 1, rival);
+			for(; heard && count > 0 && nb_expected < MAX_FRAME_ACTIONS ; count--, nb_expected++)
+				expected[nb_expected] = expected[nb_expected - 1];
+		}else if(*script == ','){
+			add_symbol(SYMBOL_SEPARATOR, rival);
+		}else if(*script == 'x'){
+			add_symbol(SYMBOL_CANCEL, rival);
+			cancelled = heard;
+		}else if(*script == ']' && !rival){
+			add_symbol(SYMBOL_END, 0);
+			cursor += TONE_DURATION;
+			break;
+		}else if(*script == '>' && !rival){
+			//no END, the frame must time out before the next command
+			cancelled = true;
+			cursor += FRAME_TIMEOUT;
+			break;
+		}else{
+			return NULL;
+		}
+	}
+
+	expected[cancelled ? 0 : nb_expected] = '\0';
+	return script + 1;
+}
+
+static void write_le(FILE *file, uint32_t value, unsigned nb_bytes)
+{
+	for(unsigned i = 0 ; i < nb_bytes ; i++, value >>= 8)
+		fputc(value & 0xFF, file);
+}
+
+static void write_header(FILE *file, unsigned nb_channels, uint32_t nb_frames)
+{
+	uint32_t data_size = nb_frames * nb_channels * sizeof(int16_t);
+
+	fwrite("RIFF", 1, 4, file);
+	write_le(file, 36 + data_size, 4);
+	fwrite("WAVEfmt ", 1, 8, file);
+	write_le(file, 16, 4);
+	write_le(file, 1, 2);                                       // PCM
+	write_le(file, nb_channels, 2);
+	write_le(file, MIC_SAMPLE_RATE, 4);
+	write_le(file, MIC_SAMPLE_RATE * nb_channels * sizeof(int16_t), 4);
+	write_le(file, nb_channels * sizeof(int16_t), 2);
+	write_le(file, 16, 2);
+	fwrite("data", 1, 4, file);
+	write_le(file, data_size, 4);
+}
+
+int main(int argc, char **argv)
+{
+	if(argc < 4 || argc > 5){
+		fprintf(stderr, "usage: %s recording.wav labels.txt script [channels]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	unsigned nb_channels = argc == 5 ? (unsigned)atoi(argv[4]) : MAX_CHANNELS;
+	if(nb_channels != 1 && nb_channels != MAX_CHANNELS){
+		fprintf(stderr, "%s: 1 or %d channels\n", argv[0], MAX_CHANNELS);
+		return EXIT_FAILURE;
+	}
+
+	FILE *wav = fopen(argv[1], "wb");
+	FILE *labels = fopen(argv[2], "w");
+	if(!wav || !labels){
+		perror(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	for(const char *script = argv[3] ; *script ;){
+		char expected[MAX_FRAME_ACTIONS + 1];
+		double start = cursor;
+
+		if(*script == '['){
+			script = add_frame(script + 1, expected);
+			if(!script){
+				fprintf(stderr, "%s: malformed frame in \"%s\"\n", argv[0], argv[3]);
+				return EXIT_FAILURE;
+			}
+		}else if(command_bin(*script) >= 0){
+			add_tone(add_sound(TONE_DURATION, TONE_DURATION), command_bin(*script), TONE_AMPLITUDE);
+			expected[0] = *script++;
+			expected[1] = '\0';
+		}else{
+			fprintf(stderr, "%s: unknown action '%c'\n", argv[0], *script);
+			return EXIT_FAILURE;
+		}
+
+		if(expected[0])
+			fprintf(labels, "%.6f\t%.6f\t%s\n", start, cursor, expected);
+	}
+
+	uint32_t nb_frames = (cursor + LEAD_IN) * MIC_SAMPLE_RATE;
+	write_header(wav, nb_channels, nb_frames);
+
+	srand(1);
+	unsigned s = 0;
+	for(uint32_t n = 0 ; n < nb_frames ; n++){
+		double t = (double)n / MIC_SAMPLE_RATE;
+		double tone = 0;
+
+		while(s < nb_sounds && t >= sounds[s].start + sounds[s].duration)
+			s++;
+		if(s < nb_sounds && t >= sounds[s].start){
+			for(unsigned i = 0 ; i < sounds[s].nb_tones ; i++){
+				double freq = sounds[s].bins[i] * MIC_SAMPLE_RATE / FFT_SIZE;
+				tone += sounds[s].amplitudes[i] * sin(2 * M_PI * freq * t);
+			}
+		}
+		for(unsigned c = 0 ; c < nb_channels ; c++){
+			double noise = NOISE_AMPLITUDE * (2.0 * rand() / RAND_MAX - 1);
+			write_le(wav, (uint16_t)(int16_t)lrint(gains[c] * tone + noise), 2);
+		}
+	}
+
+	fclose(labels);
+	return fclose(wav) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
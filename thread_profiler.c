@@ -0,0 +1,249 @@
+/**
+ * @file    thread_profiler.c
+ * @brief   Runtime view of the threads
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// ChibiOS headers
+#include "ch.h"
+#include "hal.h"
+#include "chprintf.h"
+
+// Module headers
+#include "thread_profiler.h"
+#include "mic_remote_control.h"
+#include "arm_fft.h"
+
+/*===========================================================================*/
+/* Module constants.                                                         */
+/*===========================================================================*/
+
+#define REPORT_COMMAND          'p'
+#define CYCLES_PER_US           (STM32_SYSCLK / 1000000)
+
+/*===========================================================================*/
+/* Module local variables.                                                   */
+/*===========================================================================*/
+
+typedef struct {
+	thread_t *thread;
+	uint32_t periods;
+	uint32_t misses;            // came back after the end of the window
+	bool busy;                  // neither sleeping nor waiting
+	rtcnt_t busy_since;
+	uint64_t period_busy;       // [cycles] since the last sleep
+	uint64_t worst_busy;        // [cycles] between two sleeps
+	uint64_t total_busy;        // [cycles]
+} profiled_loop_t;
+
+static profiled_loop_t loops[PROFILER_MAX_LOOPS];
+static uint8_t nb_loops = 0;
+
+/*===========================================================================*/
+/* Module local functions.                                                   */
+/*===========================================================================*/
+
+// loop of the calling thread, registered on its first call
+static profiled_loop_t *get_loop(void)
+{
+	thread_t *self = chThdGetSelfX();
+	profiled_loop_t *loop = NULL;
+
+	chSysLock();
+	for(uint8_t i = 0 ; i < nb_loops ; i++){
+		if(loops[i].thread == self)
+			loop = &loops[i];
+	}
+	if(loop == NULL && nb_loops < PROFILER_MAX_LOOPS){
+		loop = &loops[nb_loops++];
+		loop->thread = self;
+	}
+	chSysUnlock();
+
+	return loop;
+}
+
+/*
+ * The realtime counter wraps after 2^32 cycles, ~25s at 168MHz, so it only
+ * measures each busy stretch, and the sums are kept in 64 bits.
+ */
+static void busy_start(profiled_loop_t *loop)
+{
+	loop->busy_since = chSysGetRealtimeCounterX();
+	loop->busy = true;
+}
+
+static void busy_stop(profiled_loop_t *loop)
+{
+	if(loop->busy)
+		loop->period_busy += (rtcnt_t)(chSysGetRealtimeCounterX() - loop->busy_since);
+	loop->busy = false;
+}
+
+static const char *thread_state_name(tstate_t state)
+{
+	static const char *const names[] = {CH_STATE_NAMES};
+
+	if(state < sizeof(names) / sizeof(*names))
+		return names[state];
+	return "?";
+}
+
+/**
+ * @brief           Bytes of the stack never used since the thread started,
+ *                  found from the fill pattern left by chThdCreateStatic.
+ * @return          -1 if unknown.
+ */
+static int32_t stack_margin(thread_t *tp)
+{
+#if CH_DBG_FILL_THREADS
+	//the main thread runs on the process stack, not a working area
+	if(tp == &ch.mainthread)
+		return -1;
+
+	//the stack grows down towards the thread_t at the bottom of the area
+	const uint8_t *p = (const uint8_t *)(tp + 1);
+	while(*p == CH_DBG_STACK_FILL_VALUE)
+		p++;
+	return p - (const uint8_t *)(tp + 1);
+#else
+	(void)tp;
+	return -1;
+#endif
+}
+
+/*===========================================================================*/
+/* Module threads.                                                           */
+/*===========================================================================*/
+
+static THD_WORKING_AREA(wa_profiler_thd, 512);
+static THD_FUNCTION(profiler_thd, arg)
+{
+	chRegSetThreadName(__FUNCTION__);
+	(void)arg;
+
+	while(!chThdShouldTerminateX()){
+		if(chnGetTimeout(&SD3, TIME_INFINITE) == REPORT_COMMAND)
+			profiler_report((BaseSequentialStream *)&SD3);
+	}
+
+	chThdExit(0);
+}
+
+/*===========================================================================*/
+/* Module exported functions.                                                */
+/*===========================================================================*/
+
+void profiler_start(void)
+{
+	chThdCreateStatic(wa_profiler_thd, sizeof(wa_profiler_thd),
+	                  LOWPRIO, profiler_thd, NULL);
+}
+
+systime_t profiler_sleep_until_windowed(systime_t prev, systime_t next)
+{
+	profiled_loop_t *loop = get_loop();
+
+	if(loop != NULL){
+		busy_stop(loop);
+		//the first call has no previous wake up to measure from
+		if(loop->periods > 0){
+			loop->total_busy += loop->period_busy;
+			if(loop->period_busy > loop->worst_busy)
+				loop->worst_busy = loop->period_busy;
+		}
+		loop->period_busy = 0;
+		if(!chVTIsTimeWithinX(chVTGetSystemTimeX(), prev, next))
+			loop->misses++;
+		loop->periods++;
+	}
+
+	chThdSleepUntilWindowed(prev, next);
+
+	if(loop != NULL)
+		busy_start(loop);
+	return next;
+}
+
+void profiler_wait_begin(void)
+{
+	profiled_loop_t *loop = get_loop();
+
+	if(loop != NULL)
+		busy_stop(loop);
+}
+
+void profiler_wait_end(void)
+{
+	profiled_loop_t *loop = get_loop();
+
+	if(loop != NULL)
+		busy_start(loop);
+}
+
+void profiler_report(BaseSequentialStream *out)
+{
+	uint64_t total_time = 0;
+	thread_t *tp;
+
+	chprintf(out, "\r\n%-20s %4s %-8s %6s %8s\r\n",
+	         "thread", "prio", "state", "cpu%", "stk free");
+
+#if CH_DBG_THREADS_PROFILING
+	tp = chRegFirstThread();
+	while(tp != NULL){
+		total_time += tp->p_time;
+		tp = chRegNextThread(tp);
+	}
+#endif
+
+	tp = chRegFirstThread();
+	while(tp != NULL){
+		chprintf(out, "%-20s %4u %-8s ", tp->p_name ? tp->p_name : "?",
+		         (unsigned)tp->p_prio, thread_state_name(tp->p_state));
+
+#if CH_DBG_THREADS_PROFILING
+		if(total_time > 0)
+			chprintf(out, "%6u ", (unsigned)(tp->p_time * 100 / total_time));
+		else
+#endif
+			chprintf(out, "%6s ", "n/a");
+
+		int32_t margin = stack_margin(tp);
+		if(margin >= 0)
+			chprintf(out, "%8d\r\n", margin);
+		else
+			chprintf(out, "%8s\r\n", "n/a");
+
+		tp = chRegNextThread(tp);
+	}
+
+	chprintf(out, "\r\n%-20s %8s %8s %10s %10s\r\n",
+	         "loop", "periods", "missed", "avg [us]", "worst [us]");
+	for(uint8_t i = 0 ; i < nb_loops ; i++){
+		profiled_loop_t *loop = &loops[i];
+		uint32_t measured = loop->periods > 1 ? loop->periods - 1 : 1;
+
+		chprintf(out, "%-20s %8u %8u %10u %10u\r\n",
+		         loop->thread->p_name ? loop->thread->p_name : "?",
+		         (unsigned)loop->periods, (unsigned)loop->misses,
+		         (unsigned)(loop->total_busy / measured / CYCLES_PER_US),
+		         (unsigned)(loop->worst_busy / CYCLES_PER_US));
+	}
+
+	mic_stats_t mic;
+	get_mic_stats(&mic);
+	chprintf(out, "\r\naudio: %u blocks, %u dropped, avg %u us, worst %u us\r\n",
+	         (unsigned)mic.nb_blocks, (unsigned)mic.dropped_blocks,
+	         (unsigned)mic.average_us, (unsigned)mic.worst_us);
+
+#if FFT_CYCLE_COUNT
+	fft_cycles_t fft;
+	fft_get_cycles(&fft);
+	chprintf(out, "fft %s: %u frames, avg %u cycles, worst %u cycles, %u bytes of buffers\r\n",
+	         FFT_BACKEND_NAME, (unsigned)fft.nb_frames, (unsigned)fft.average,
+	         (unsigned)fft.worst, (unsigned)FFT_BUFFER_BYTES);
+#endif
+}
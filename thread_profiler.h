@@ -0,0 +1,54 @@
+/**
+ * @file    thread_profiler.h
+ * @brief   Runtime view of the threads: CPU share, stack margins and
+ *          periodic loops that miss their deadline.
+ *
+ * Send 'p' on the serial link (SD3) to get a report. The CPU share needs
+ * CH_DBG_THREADS_PROFILING and the stack margins CH_DBG_FILL_THREADS in
+ * chconf.h, the report says n/a otherwise.
+ */
+
+#ifndef _THREAD_PROFILER_H_
+#define _THREAD_PROFILER_H_
+
+#include <ch.h>
+#include <hal.h>
+
+#define PROFILER_MAX_LOOPS      8
+
+/*===========================================================================*/
+/*  External declarations                                                    */
+/*===========================================================================*/
+
+/**
+ * @brief           Starts the thread answering report requests on SD3.
+ */
+void profiler_start(void);
+
+/**
+ * @brief           Drop-in replacement for chThdSleepUntilWindowed in
+ *                  periodic loops. Counts the periods where the loop came
+ *                  back after `next`, and measures the time the loop spent
+ *                  between two sleeps.
+ * @note            Keep an absolute deadline, as in
+ *                  `deadline = profiler_sleep_until_windowed(deadline, deadline + period);`
+ *                  A window taken from chVTGetSystemTime() right before the
+ *                  call is never missed.
+ * @return          next, the start of the next period.
+ */
+systime_t profiler_sleep_until_windowed(systime_t prev, systime_t next);
+
+/**
+ * @brief           Brackets a blocking wait of a profiled loop outside of
+ *                  profiler_sleep_until_windowed, so that it isn't counted as
+ *                  busy time.
+ */
+void profiler_wait_begin(void);
+void profiler_wait_end(void);
+
+/**
+ * @brief           Prints one line per thread, then one per profiled loop.
+ */
+void profiler_report(BaseSequentialStream *out);
+
+#endif /* _THREAD_PROFILER_H_ */
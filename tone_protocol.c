@@ -0,0 +1,170 @@
+/**
+ * @file    tone_protocol.c
+ * @brief   Decoder for action sequences sent as dual tones
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Module headers
+#include "tone_protocol.h"
+
+/*===========================================================================*/
+/* Module constants.                                                         */
+/*===========================================================================*/
+
+// a tone must be that many times stronger than the others of its group
+#define TONE_DOMINANCE          2.0f
+// consecutive windows that must agree on a symbol
+#define TONE_NB_VOTES           2
+
+#define NO_SYMBOL               -1
+#define NB_ACTION_SYMBOLS       4
+#define FIRST_REPEAT_SYMBOL     4
+#define LAST_REPEAT_SYMBOL      11
+#define SYMBOL_SEPARATOR        12
+#define SYMBOL_CANCEL           13
+#define SYMBOL_START            14
+#define SYMBOL_END              15
+
+// 500, 547, 594, 641 Hz then 703, 766, 828, 891 Hz
+const uint16_t tone_protocol_bins[TONE_NB_BINS] = {
+	32, 35, 38, 41,
+	45, 49, 53, 57
+};
+
+static const action_t symbol_actions[NB_ACTION_SYMBOLS] = {
+	ACTION_BACK, ACTION_STRAIGHT, ACTION_LEFT, ACTION_RIGHT
+};
+
+/*===========================================================================*/
+/* Module local variables.                                                   */
+/*===========================================================================*/
+
+static int8_t votes[TONE_NB_VOTES] = { NO_SYMBOL, NO_SYMBOL };
+static uint8_t votes_index = 0;
+static int8_t last_symbol = NO_SYMBOL;
+
+static bool receiving = false;
+static action_t frame[TONE_MAX_FRAME_ACTIONS];
+static uint16_t frame_len = 0;
+static uint16_t idle_windows = 0;
+static uint16_t frame_timeout = 0;
+static void (*push_action)(action_t) = NULL;
+
+/*===========================================================================*/
+/* Module local functions.                                                   */
+/*===========================================================================*/
+
+/**
+ * @brief           Index of the tone of a group, if one clearly stands out.
+ *
+ * @return          The index in the group, or NO_SYMBOL.
+ */
+static int8_t strongest_tone(const float *magnitude, float threshold){
+	int8_t best = 0;
+
+	for(int8_t i = 1 ; i < TONE_NB_GROUP_BINS ; i++){
+		if(magnitude[i] > magnitude[best])
+			best = i;
+	}
+
+	if(magnitude[best] < threshold)
+		return NO_SYMBOL;
+
+	for(int8_t i = 0 ; i < TONE_NB_GROUP_BINS ; i++){
+		if(i != best && magnitude[i] * TONE_DOMINANCE > magnitude[best])
+			return NO_SYMBOL;
+	}
+
+	return best;
+}
+
+static void frame_append(action_t action, uint8_t count){
+	while(count--){
+		if(frame_len >= TONE_MAX_FRAME_ACTIONS){
+			// a truncated route would be wrong, drop the whole frame
+			receiving = false;
+			return;
+		}
+		frame[frame_len++] = action;
+	}
+}
+
+static void handle_symbol(int8_t symbol){
+	if(symbol == SYMBOL_START){
+		receiving = true;
+		frame_len = 0;
+		return;
+	}
+	if(!receiving)
+		return;
+
+	if(symbol < NB_ACTION_SYMBOLS){
+		frame_append(symbol_actions[symbol], 1);
+	}
+	else if(symbol <= LAST_REPEAT_SYMBOL){
+		// a repeat without an action before it is an error
+		if(frame_len == 0)
+			receiving = false;
+		else
+			frame_append(frame[frame_len - 1], symbol - FIRST_REPEAT_SYMBOL + 1);
+	}
+	else if(symbol == SYMBOL_CANCEL){
+		receiving = false;
+	}
+	else if(symbol == SYMBOL_END){
+		for(uint16_t i = 0 ; i < frame_len ; i++)
+			push_action(frame[i]);
+		receiving = false;
+	}
+	// SYMBOL_SEPARATOR only splits equal symbols
+}
+
+/*===========================================================================*/
+/* Module exported functions.                                                */
+/*===========================================================================*/
+
+void tone_protocol_reset(uint16_t timeout, void (*push)(action_t)){
+	for(uint8_t i = 0 ; i < TONE_NB_VOTES ; i++)
+		votes[i] = NO_SYMBOL;
+	last_symbol = NO_SYMBOL;
+	receiving = false;
+	frame_len = 0;
+	idle_windows = 0;
+	frame_timeout = timeout;
+	push_action = push;
+}
+
+bool tone_protocol_window(const float *magnitude, float threshold){
+	int8_t low = strongest_tone(magnitude, threshold);
+	int8_t high = strongest_tone(&magnitude[TONE_NB_GROUP_BINS], threshold);
+	int8_t symbol = NO_SYMBOL;
+
+	if(low != NO_SYMBOL && high != NO_SYMBOL)
+		symbol = low * TONE_NB_GROUP_BINS + high;
+
+	votes[votes_index++] = symbol;
+	votes_index %= TONE_NB_VOTES;
+
+	bool agreed = true;
+	for(uint8_t i = 1 ; i < TONE_NB_VOTES ; i++){
+		if(votes[i] != votes[0])
+			agreed = false;
+	}
+
+	idle_windows++;
+	if(agreed && symbol != last_symbol){
+		last_symbol = symbol;
+		if(symbol != NO_SYMBOL){
+			idle_windows = 0;
+			handle_symbol(symbol);
+		}
+	}
+
+	if(receiving && idle_windows >= frame_timeout)
+		receiving = false;
+
+	return receiving || symbol != NO_SYMBOL;
+}
@@ -0,0 +1,64 @@
+/**
+ * @file    tone_protocol.h
+ * @brief   Decoder for whole action sequences sent as dual tones.
+ *
+ * Like DTMF, every symbol is a pair of simultaneous tones, one from a low
+ * group and one from a high group, which gives 16 symbols:
+ *
+ *           high 0   high 1   high 2   high 3
+ *   low 0     B        S        L        R       actions
+ *   low 1     +1       +2       +3       +4      previous action again n times
+ *   low 2     +5       +6       +7       +8
+ *   low 3   separ.   cancel   START    END
+ *
+ * A frame is START, the actions, then END; the actions are only pushed to
+ * the action queue once END is heard. A symbol is registered when it differs
+ * from the previous one, so two equal symbols in a row must be separated by
+ * the separator or a short silence. "S S S L" can be sent as
+ * START S +2 L END.
+ */
+
+#ifndef _TONE_PROTOCOL_H_
+#define _TONE_PROTOCOL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "action.h"
+
+#define TONE_NB_GROUP_BINS      4
+#define TONE_NB_BINS            (2 * TONE_NB_GROUP_BINS)
+#define TONE_MAX_FRAME_ACTIONS  64
+
+/*===========================================================================*/
+/*  External declarations                                                    */
+/*===========================================================================*/
+
+/**
+ * @brief           Bins of a 1024-point DFT at 16kHz used by the symbols,
+ *                  the low group then the high group. None is a harmonic
+ *                  of another, and they stay clear of the single tone
+ *                  commands.
+ */
+extern const uint16_t tone_protocol_bins[TONE_NB_BINS];
+
+/**
+ * @brief           Drops any frame being received.
+ *
+ * @param timeout   Number of windows without a new symbol after which a
+ *                  frame is dropped.
+ * @param push      Receives the actions of every complete frame.
+ */
+void tone_protocol_reset(uint16_t timeout, void (*push)(action_t));
+
+/**
+ * @brief           Decodes one analysis window.
+ *
+ * @param magnitude Magnitude of tone_protocol_bins over the window.
+ * @param threshold Minimum magnitude of a tone.
+ * @return          true if the window holds a symbol or a frame is being
+ *                  received, the single tone commands must then be ignored.
+ */
+bool tone_protocol_window(const float *magnitude, float threshold);
+
+#endif /* _TONE_PROTOCOL_H_ */